@@ -0,0 +1,248 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <thread.h>
+#include <orb/orbindex.h>
+
+using namespace std;
+
+#define DEFAULT_NB_WRITERS 2
+#define DEFAULT_NB_READERS 4
+#define DEFAULT_DURATION 10
+#define NB_IMAGES 20000
+#define NB_WORDS_PER_IMAGE 300
+
+
+void printUsage()
+{
+    cout << "Usage :" << endl
+         << "./pastec-bench-index-stress [nbWriters] [nbReaders] [durationInSeconds]" << endl
+         << "Run concurrent adds, removes and searches on an index and print their throughput." << endl;
+}
+
+
+/**
+ * @brief Return the time elapsed since an instant in ms.
+ */
+static double getElapsedTime(const timeval &t0)
+{
+    timeval t1;
+    gettimeofday(&t1, NULL);
+    return (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000.0;
+}
+
+
+/**
+ * @brief Return a random word id skewed towards the small ids as the
+ * frequent visual words are.
+ */
+static u_int32_t getRandomWordId(unsigned &i_seed)
+{
+    i_seed = i_seed * 1103515245 + 12345;
+    const double f_rand = (i_seed >> 8) / (double)(1 << 24);
+    return f_rand * f_rand * NB_VISUAL_WORDS;
+}
+
+
+/**
+ * @brief Return the hits of a random image.
+ */
+static list<HitForward> getRandomHits(u_int32_t i_imageId, unsigned &i_seed)
+{
+    list<HitForward> hitList;
+    for (unsigned i = 0; i < NB_WORDS_PER_IMAGE; ++i)
+    {
+        HitForward hit;
+        hit.i_wordId = getRandomWordId(i_seed);
+        hit.i_imageId = i_imageId;
+        hit.i_angle = i;
+        hit.x = i;
+        hit.y = i;
+        hitList.push_back(hit);
+    }
+    return hitList;
+}
+
+
+/**
+ * @brief A thread that adds random images and removes one image for two adds.
+ */
+class WriterThread : public Thread
+{
+public:
+    WriterThread(ORBIndex *index, unsigned i_seed)
+        : index(index), i_seed(i_seed), i_nbAdds(0), i_nbRemoves(0) { }
+
+    ORBIndex *index;
+    unsigned i_seed;
+    unsigned i_nbAdds;
+    unsigned i_nbRemoves;
+
+private:
+    void *run()
+    {
+        while (!b_mustStop)
+        {
+            i_seed = i_seed * 1103515245 + 12345;
+            const u_int32_t i_imageId = (i_seed >> 8) % NB_IMAGES;
+            if (i_seed % 3 == 0)
+            {
+                index->removeImage(i_imageId);
+                i_nbRemoves++;
+            }
+            else
+            {
+                index->addImage(i_imageId, getRandomHits(i_imageId, i_seed));
+                i_nbAdds++;
+            }
+        }
+        return NULL;
+    }
+};
+
+
+/**
+ * @brief A thread that reads the hits of the words of random images in
+ * snapshots of the index and counts the visible ones as the searches do.
+ */
+class ReaderThread : public Thread
+{
+public:
+    ReaderThread(ORBIndex *index, unsigned i_seed)
+        : index(index), i_seed(i_seed), i_nbHits(0) { }
+
+    ORBIndex *index;
+    unsigned i_seed;
+    u_int64_t i_nbHits;
+    vector<double> searchTimes;
+
+private:
+    void *run()
+    {
+        while (!b_mustStop)
+        {
+            unordered_map<u_int32_t, list<Hit> > imageReqHits;
+            for (unsigned i = 0; i < NB_WORDS_PER_IMAGE; ++i)
+                imageReqHits[getRandomWordId(i_seed)];
+
+            timeval t;
+            gettimeofday(&t, NULL);
+            IndexSnapshot snapshot;
+            index->getSnapshot(snapshot);
+            unordered_map<u_int32_t, WordHits> indexHits;
+            index->getImagesWithVisualWords(snapshot, imageReqHits, indexHits);
+
+            vector<Hit> hits;
+            for (unordered_map<u_int32_t, WordHits>::const_iterator it = indexHits.begin();
+                 it != indexHits.end(); ++it)
+            {
+                hits.clear();
+                it->second.getHits(hits);
+                for (unsigned i = 0; i < hits.size(); ++i)
+                    if (snapshot.isSlotVisible(hits[i].i_imageId))
+                        i_nbHits++;
+            }
+            searchTimes.push_back(getElapsedTime(t));
+        }
+        return NULL;
+    }
+};
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 4)
+    {
+        printUsage();
+        return 1;
+    }
+    const unsigned i_nbWriters = argc > 1 ? atoi(argv[1]) : DEFAULT_NB_WRITERS;
+    const unsigned i_nbReaders = argc > 2 ? atoi(argv[2]) : DEFAULT_NB_READERS;
+    const unsigned i_duration = argc > 3 ? atoi(argv[3]) : DEFAULT_DURATION;
+
+    // The index logs each modification.
+    cout << "Filling the index with " << NB_IMAGES / 2 << " images." << endl;
+    cout.setstate(ios_base::failbit);
+    ORBIndex *index = new ORBIndex("", false, false, 0, false, false);
+    unsigned i_seed = 1;
+    for (u_int32_t i_imageId = 0; i_imageId < NB_IMAGES; i_imageId += 2)
+        index->addImage(i_imageId, getRandomHits(i_imageId, i_seed));
+    index->mergeDelta();
+
+    vector<WriterThread *> writers;
+    vector<ReaderThread *> readers;
+    for (unsigned i = 0; i < i_nbWriters; ++i)
+        writers.push_back(new WriterThread(index, 2 * i + 1));
+    for (unsigned i = 0; i < i_nbReaders; ++i)
+        readers.push_back(new ReaderThread(index, 2 * i + 2));
+
+    for (unsigned i = 0; i < writers.size(); ++i)
+        writers[i]->start();
+    for (unsigned i = 0; i < readers.size(); ++i)
+        readers[i]->start();
+    sleep(i_duration);
+    for (unsigned i = 0; i < writers.size(); ++i)
+        writers[i]->join();
+    for (unsigned i = 0; i < readers.size(); ++i)
+        readers[i]->join();
+    cout.clear();
+
+    unsigned i_nbAdds = 0, i_nbRemoves = 0;
+    for (unsigned i = 0; i < writers.size(); ++i)
+    {
+        i_nbAdds += writers[i]->i_nbAdds;
+        i_nbRemoves += writers[i]->i_nbRemoves;
+        delete writers[i];
+    }
+    vector<double> searchTimes;
+    u_int64_t i_nbHits = 0;
+    for (unsigned i = 0; i < readers.size(); ++i)
+    {
+        searchTimes.insert(searchTimes.end(), readers[i]->searchTimes.begin(),
+                           readers[i]->searchTimes.end());
+        i_nbHits += readers[i]->i_nbHits;
+        delete readers[i];
+    }
+    sort(searchTimes.begin(), searchTimes.end());
+
+    cout << i_nbWriters << " writers, " << i_nbReaders << " readers, "
+         << i_duration << " s." << endl;
+    cout << (double)i_nbAdds / i_duration << " adds/s, "
+         << (double)i_nbRemoves / i_duration << " removes/s, "
+         << (double)searchTimes.size() / i_duration << " searches/s." << endl;
+    if (!searchTimes.empty())
+        cout << "Search time: p50 " << searchTimes[searchTimes.size() / 2] << " ms, p99 "
+             << searchTimes[searchTimes.size() * 99 / 100] << " ms, max "
+             << searchTimes.back() << " ms, " << i_nbHits / searchTimes.size()
+             << " visible hits per search." << endl;
+
+    delete index;
+
+    return 0;
+}
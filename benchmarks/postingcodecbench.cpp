@@ -0,0 +1,136 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <sys/time.h>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <postingcodec.h>
+#include <orb/indexepoch.h>
+
+using namespace std;
+
+#define DEFAULT_NB_IMAGES 20000
+#define DEFAULT_NB_WORDS_PER_IMAGE 1000
+
+
+void printUsage()
+{
+    cout << "Usage :" << endl
+         << "./pastec-bench-postingcodec [nbImages] [nbWordsPerImage]" << endl
+         << "Compare the scan of raw and of compressed image ids of a synthetic base segment." << endl;
+}
+
+
+/**
+ * @brief Return the time elapsed between two instants in seconds.
+ */
+static double getElapsedTime(const timeval &t0, const timeval &t1)
+{
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 3)
+    {
+        printUsage();
+        return 1;
+    }
+    const unsigned i_nbImages = argc > 1 ? atoi(argv[1]) : DEFAULT_NB_IMAGES;
+    const unsigned i_nbWordsPerImage = argc > 2 ? atoi(argv[2]) : DEFAULT_NB_WORDS_PER_IMAGE;
+
+    /* The words of the images are skewed towards the small ids as the
+     * frequent visual words are. The images are added in order so the
+     * posting lists are sorted by image id. */
+    cout << "Building the posting lists of " << i_nbImages << " images." << endl;
+    vector<vector<u_int32_t> > postings(NB_VISUAL_WORDS);
+    unsigned i_seed = 1;
+    for (unsigned i_imageId = 0; i_imageId < i_nbImages; ++i_imageId)
+        for (unsigned i = 0; i < i_nbWordsPerImage; ++i)
+        {
+            i_seed = i_seed * 1103515245 + 12345;
+            const double f_rand = (i_seed >> 8) / (double)(1 << 24);
+            const unsigned i_wordId = f_rand * f_rand * NB_VISUAL_WORDS;
+            if (postings[i_wordId].empty() || postings[i_wordId].back() != i_imageId)
+                postings[i_wordId].push_back(i_imageId);
+        }
+
+    vector<u_int64_t> offsets(NB_VISUAL_WORDS + 1);
+    vector<u_int64_t> packedOffsets(NB_VISUAL_WORDS + 1);
+    for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+    {
+        const vector<u_int32_t> &ids = postings[i_wordId];
+        offsets[i_wordId + 1] = offsets[i_wordId] + ids.size();
+        packedOffsets[i_wordId + 1] = packedOffsets[i_wordId]
+            + PostingCodec::encodedSize(ids.data(), ids.size());
+    }
+    const u_int64_t i_nbHits = offsets[NB_VISUAL_WORDS];
+
+    vector<u_int32_t> rawIds(i_nbHits);
+    vector<u_int8_t> packedIds(packedOffsets[NB_VISUAL_WORDS] + POSTING_CODEC_PADDING);
+    for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+    {
+        const vector<u_int32_t> &ids = postings[i_wordId];
+        copy(ids.begin(), ids.end(), rawIds.begin() + offsets[i_wordId]);
+        PostingCodec::encode(ids.data(), ids.size(), packedIds.data() + packedOffsets[i_wordId]);
+    }
+    postings.clear();
+
+    // Scan all the ids word by word as the searches do.
+    timeval t[3];
+    u_int64_t i_rawSum = 0, i_packedSum = 0;
+    gettimeofday(&t[0], NULL);
+    for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+        for (u_int64_t i = offsets[i_wordId]; i < offsets[i_wordId + 1]; ++i)
+            i_rawSum += rawIds[i];
+
+    gettimeofday(&t[1], NULL);
+    vector<u_int32_t> imageIds;
+    for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+    {
+        const u_int64_t i_nbWordHits = offsets[i_wordId + 1] - offsets[i_wordId];
+        imageIds.resize(i_nbWordHits);
+        PostingCodec::decode(packedIds.data() + packedOffsets[i_wordId], i_nbWordHits,
+                             imageIds.data());
+        for (u_int64_t i = 0; i < i_nbWordHits; ++i)
+            i_packedSum += imageIds[i];
+    }
+    gettimeofday(&t[2], NULL);
+
+    if (i_rawSum != i_packedSum)
+    {
+        cout << "The decoded ids differ from the raw ones." << endl;
+        return 1;
+    }
+
+    const double f_rawTime = getElapsedTime(t[0], t[1]);
+    const double f_packedTime = getElapsedTime(t[1], t[2]);
+    cout << i_nbHits << " image ids compressed from " << i_nbHits * sizeof(u_int32_t) / (1 << 20)
+         << " MB to " << packedOffsets[NB_VISUAL_WORDS] / (1 << 20) << " MB." << endl;
+    cout << "Image id scan: " << i_nbHits / f_rawTime / 1e6 << " M ids/s raw, "
+         << i_nbHits / f_packedTime / 1e6 << " M ids/s compressed." << endl;
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <sys/time.h>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <imagereranker.h>
+#include <rigidtransformverifier.h>
+
+using namespace std;
+
+#define DEFAULT_NB_SETS 3000
+#define DEFAULT_SEED 1
+#define MIN_NB_POINTS 12
+#define MAX_NB_POINTS 412
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
+
+// The kinds of correspondence sets.
+#define NO_MATCH 0
+#define MATCH 1
+#define WEAK_MATCH 2
+
+
+void printUsage()
+{
+    cout << "Usage :" << endl
+         << "./pastec-bench-ransac-check [nbSets] [seed]" << endl
+         << "Compare the decisions of the verifier with the ones of pastecEstimateRigidTransform on synthetic correspondence sets." << endl;
+}
+
+
+/**
+ * @brief Return the time elapsed since an instant in ms.
+ */
+static double getElapsedTime(const timeval &t0)
+{
+    timeval t1;
+    gettimeofday(&t1, NULL);
+    return (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000.0;
+}
+
+
+/**
+ * @brief A linear congruential generator so that the sets only depend on the seed.
+ */
+struct SetGenerator
+{
+    SetGenerator(unsigned i_seed) : i_state(i_seed) { }
+
+    // Return a number in [0, 1).
+    float uniform()
+    {
+        i_state = i_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (i_state >> 40) / (float)(1 << 24);
+    }
+
+    unsigned uniform(unsigned n)
+    {
+        return uniform() * n;
+    }
+
+    u_int64_t i_state;
+};
+
+
+/**
+ * @brief Generate a set of correspondences. The matches map a part of the
+ * points of the first image by a similarity with an error of up to one
+ * pixel, the weak matches only 10 to 17 points.
+ */
+static void generateSet(SetGenerator &gen, unsigned i_kind,
+                        vector<Point2f> &points1, vector<Point2f> &points2)
+{
+    const float f_rand = gen.uniform();
+    const unsigned i_nbPoints = MIN_NB_POINTS + f_rand * f_rand * (MAX_NB_POINTS - MIN_NB_POINTS);
+    const float f_angle = gen.uniform() * 2 * M_PI;
+    const float f_scale = 0.5f + gen.uniform() * 1.5f;
+    const float f_tx = gen.uniform() * 300, f_ty = gen.uniform() * 300;
+    float f_inlierRatio = 0;
+    if (i_kind == MATCH)
+        f_inlierRatio = 0.2f + 0.7f * gen.uniform();
+    else if (i_kind == WEAK_MATCH)
+        f_inlierRatio = min(1.f, (10 + gen.uniform(8)) / (float)i_nbPoints);
+
+    points1.clear();
+    points2.clear();
+    for (unsigned i = 0; i < i_nbPoints; ++i)
+    {
+        const Point2f p1(gen.uniform(IMAGE_WIDTH), gen.uniform(IMAGE_HEIGHT));
+        Point2f p2;
+        if (gen.uniform() < f_inlierRatio)
+        {
+            p2.x = f_scale * (cos(f_angle) * p1.x - sin(f_angle) * p1.y) + f_tx + gen.uniform() * 2 - 1;
+            p2.y = f_scale * (sin(f_angle) * p1.x + cos(f_angle) * p1.y) + f_ty + gen.uniform() * 2 - 1;
+        }
+        else
+            p2 = Point2f(gen.uniform(IMAGE_WIDTH), gen.uniform(IMAGE_HEIGHT));
+        points1.push_back(p1);
+        points2.push_back(p2);
+    }
+}
+
+
+/**
+ * @brief The decisions of a verification method on all the sets.
+ */
+struct CheckResult
+{
+    CheckResult() : i_nbAccepted(0), i_nbLost(0), i_nbGained(0),
+                    i_nbIterations(0), f_time(0) { }
+
+    unsigned i_nbAccepted;
+    unsigned i_nbLost; // Accepted by the reference only.
+    unsigned i_nbGained; // Accepted by this method only.
+    u_int64_t i_nbIterations;
+    double f_time;
+};
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 3)
+    {
+        printUsage();
+        return 1;
+    }
+    const unsigned i_nbSets = argc > 1 ? atoi(argv[1]) : DEFAULT_NB_SETS;
+    const unsigned i_seed = argc > 2 ? atoi(argv[2]) : DEFAULT_SEED;
+
+    SetGenerator gen(i_seed);
+    RigidTransformVerifier fixedVerifier(false), adaptiveVerifier(true);
+    const vector<float> qualities;
+    CheckResult reference, fixedBound, adaptiveBound;
+    unsigned i_nbWeakMatches = 0, i_nbWeakMatchesAccepted = 0, i_nbWeakMatchesLost = 0;
+
+    vector<Point2f> points1, points2;
+    for (unsigned i = 0; i < i_nbSets; ++i)
+    {
+        const unsigned i_kind = gen.uniform(3);
+        generateSet(gen, i_kind, points1, points2);
+        i_nbWeakMatches += i_kind == WEAK_MATCH;
+
+        timeval t;
+        gettimeofday(&t, NULL);
+        Mat H = RerankingTask::pastecEstimateRigidTransform(points1, points2, true);
+        const bool b_reference = countNonZero(H) != 0;
+        reference.f_time += getElapsedTime(t);
+        reference.i_nbAccepted += b_reference;
+        i_nbWeakMatchesAccepted += b_reference && i_kind == WEAK_MATCH;
+
+        double M[6];
+        gettimeofday(&t, NULL);
+        const bool b_fixed = fixedVerifier.verify(points1, points2, qualities, M);
+        fixedBound.f_time += getElapsedTime(t);
+        fixedBound.i_nbIterations += fixedVerifier.getNbIterations();
+        fixedBound.i_nbAccepted += b_fixed;
+        fixedBound.i_nbLost += b_reference && !b_fixed;
+        fixedBound.i_nbGained += b_fixed && !b_reference;
+
+        gettimeofday(&t, NULL);
+        const bool b_adaptive = adaptiveVerifier.verify(points1, points2, qualities, M);
+        adaptiveBound.f_time += getElapsedTime(t);
+        adaptiveBound.i_nbIterations += adaptiveVerifier.getNbIterations();
+        adaptiveBound.i_nbAccepted += b_adaptive;
+        adaptiveBound.i_nbLost += b_reference && !b_adaptive;
+        adaptiveBound.i_nbGained += b_adaptive && !b_reference;
+        if (b_reference && !b_adaptive)
+        {
+            i_nbWeakMatchesLost += i_kind == WEAK_MATCH;
+            cout << "Set " << i << " of " << points1.size()
+                 << " points rejected with the adaptive bound." << endl;
+        }
+    }
+
+    cout << i_nbSets << " sets, seed " << i_seed << ", "
+         << i_nbWeakMatches << " weak matches." << endl;
+    cout << "reference:      " << reference.i_nbAccepted << " accepted ("
+         << i_nbWeakMatchesAccepted << " weak matches), " << reference.f_time << " ms." << endl;
+    cout << "fixed bound:    " << fixedBound.i_nbAccepted << " accepted, "
+         << fixedBound.i_nbLost << " lost, " << fixedBound.i_nbGained << " gained, "
+         << fixedBound.i_nbIterations << " iterations, " << fixedBound.f_time << " ms." << endl;
+    cout << "adaptive bound: " << adaptiveBound.i_nbAccepted << " accepted, "
+         << adaptiveBound.i_nbLost << " lost (" << i_nbWeakMatchesLost << " weak matches), "
+         << adaptiveBound.i_nbGained << " gained, "
+         << adaptiveBound.i_nbIterations << " iterations, " << adaptiveBound.f_time << " ms." << endl;
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <sys/time.h>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <thread.h>
+#include <threadpool.h>
+
+using namespace std;
+
+#define DEFAULT_MAX_NB_THREADS 16
+#define NB_CLIENTS 8
+#define NB_QUERIES_PER_CLIENT 200
+// Each query is split in NB_TASKS tasks of NB_TASK_ITERATIONS iterations as a ranking is.
+#define NB_TASKS 4
+#define NB_TASK_ITERATIONS 200000
+#define NB_DISPATCHES 20000
+
+
+void printUsage()
+{
+    cout << "Usage :" << endl
+         << "./pastec-bench-threadpool [maxNbThreads]" << endl
+         << "Measure the dispatch cost of the thread pool and how the queries scale with its size." << endl;
+}
+
+
+/**
+ * @brief Return the time elapsed since an instant in ms.
+ */
+static double getElapsedTime(const timeval &t0)
+{
+    timeval t1;
+    gettimeofday(&t1, NULL);
+    return (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000.0;
+}
+
+
+/**
+ * @brief A task that does nothing.
+ */
+class EmptyTask : public PoolTask
+{
+public:
+    void run() { }
+};
+
+
+/**
+ * @brief A thread that does nothing.
+ */
+class EmptyThread : public Thread
+{
+private:
+    void *run() { return NULL; }
+};
+
+
+/**
+ * @brief A task that computes a pseudo random sequence.
+ */
+class ComputeTask : public PoolTask
+{
+public:
+    ComputeTask() : i_result(0) { }
+
+    void run()
+    {
+        unsigned i_seed = 1;
+        for (unsigned i = 0; i < NB_TASK_ITERATIONS; ++i)
+            i_seed = i_seed * 1103515245 + 12345;
+        i_result = i_seed;
+    }
+
+    volatile unsigned i_result;
+};
+
+
+/**
+ * @brief A client that sends its queries to the pool one after the other.
+ */
+class ClientThread : public Thread
+{
+public:
+    ClientThread(ThreadPool *pool) : pool(pool) { }
+
+    ThreadPool *pool;
+    vector<double> queryTimes;
+
+private:
+    void *run()
+    {
+        for (unsigned i = 0; i < NB_QUERIES_PER_CLIENT; ++i)
+        {
+            timeval t;
+            gettimeofday(&t, NULL);
+            TaskGroup group;
+            ComputeTask tasks[NB_TASKS];
+            for (unsigned j = 0; j < NB_TASKS; ++j)
+                pool->submit(&tasks[j], group);
+            group.wait();
+            queryTimes.push_back(getElapsedTime(t));
+        }
+        return NULL;
+    }
+};
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 2)
+    {
+        printUsage();
+        return 1;
+    }
+    const unsigned i_maxNbThreads = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_NB_THREADS;
+
+    // The cost of a query of 8 empty tasks with the pool and with new threads.
+    ThreadPool *pool = new ThreadPool(4);
+    timeval t;
+    gettimeofday(&t, NULL);
+    for (unsigned i = 0; i < NB_DISPATCHES; ++i)
+    {
+        TaskGroup group;
+        EmptyTask tasks[8];
+        for (unsigned j = 0; j < 8; ++j)
+            pool->submit(&tasks[j], group);
+        group.wait();
+    }
+    const double f_poolTime = getElapsedTime(t);
+    delete pool;
+
+    gettimeofday(&t, NULL);
+    for (unsigned i = 0; i < NB_DISPATCHES; ++i)
+    {
+        EmptyThread threads[8];
+        for (unsigned j = 0; j < 8; ++j)
+            threads[j].start();
+        for (unsigned j = 0; j < 8; ++j)
+            threads[j].join();
+    }
+    const double f_threadTime = getElapsedTime(t);
+    cout << "8 empty tasks: " << f_poolTime * 1000 / NB_DISPATCHES << " us with the pool, "
+         << f_threadTime * 1000 / NB_DISPATCHES << " us with new threads." << endl;
+
+    // The throughput and the latency of concurrent queries for each pool size.
+    cout << NB_CLIENTS << " clients, queries of " << NB_TASKS << " tasks." << endl;
+    cout << "threads  queries/s  p50 ms  p99 ms" << endl;
+    for (unsigned i_nbThreads = 1; i_nbThreads <= i_maxNbThreads; i_nbThreads *= 2)
+    {
+        pool = new ThreadPool(i_nbThreads);
+        vector<ClientThread *> clients;
+        for (unsigned i = 0; i < NB_CLIENTS; ++i)
+            clients.push_back(new ClientThread(pool));
+
+        gettimeofday(&t, NULL);
+        for (unsigned i = 0; i < clients.size(); ++i)
+            clients[i]->start();
+        for (unsigned i = 0; i < clients.size(); ++i)
+            clients[i]->join();
+        const double f_time = getElapsedTime(t);
+
+        vector<double> queryTimes;
+        for (unsigned i = 0; i < clients.size(); ++i)
+        {
+            queryTimes.insert(queryTimes.end(), clients[i]->queryTimes.begin(),
+                              clients[i]->queryTimes.end());
+            delete clients[i];
+        }
+        sort(queryTimes.begin(), queryTimes.end());
+        delete pool;
+
+        cout << i_nbThreads << "\t" << queryTimes.size() * 1000 / f_time << "\t"
+             << queryTimes[queryTimes.size() / 2] << "\t"
+             << queryTimes[queryTimes.size() * 99 / 100] << endl;
+    }
+
+    return 0;
+}
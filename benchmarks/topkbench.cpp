@@ -0,0 +1,150 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <sys/time.h>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <vector>
+
+#include <scoreaccumulator.h>
+
+using namespace std;
+
+#define DEFAULT_NB_SLOTS 2000000
+#define DEFAULT_NB_FIRST_RESULTS 300
+#define NB_RUNS 5
+
+
+void printUsage()
+{
+    cout << "Usage :" << endl
+         << "./pastec-bench-topk [nbSlots] [nbFirstResults]" << endl
+         << "Compare the selection of the first scores of an accumulator with a full sort." << endl;
+}
+
+
+/**
+ * @brief Return the time elapsed since an instant in ms.
+ */
+static double getElapsedTime(const timeval &t0)
+{
+    timeval t1;
+    gettimeofday(&t1, NULL);
+    return (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000.0;
+}
+
+
+/**
+ * @brief Return a score of a slot for a distribution or 0 if the slot is not scored.
+ */
+static float getScore(unsigned i_distribution, unsigned i_slot)
+{
+    switch (i_distribution)
+    {
+    case 0: // Uniform scores, all the slots are scored.
+        return rand() / (float)RAND_MAX + 1e-6f;
+    case 1: // Skewed scores, 10% of the slots are scored.
+        if (rand() % 10)
+            return 0;
+        return 1.f / pow((rand() % 100000) + 1.0, 1.1);
+    case 2: // Scores increasing with the slot, the worst case of the selection.
+        return 1e-6f * (i_slot + 1);
+    default: // Four distinct scores.
+        return (rand() % 4 + 1) * 0.25f;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 3)
+    {
+        printUsage();
+        return 1;
+    }
+    const unsigned i_nbSlots = argc > 1 ? atoi(argv[1]) : DEFAULT_NB_SLOTS;
+    const unsigned k = argc > 2 ? atoi(argv[2]) : DEFAULT_NB_FIRST_RESULTS;
+
+    const char *distributions[] = {"uniform", "skewed 10%", "increasing", "4 values"};
+    cout << i_nbSlots << " slots, first " << k << " results, best of "
+         << NB_RUNS << " runs in ms." << endl;
+    cout << "distribution  scored   full sort  priority_queue  getFirstResults" << endl;
+
+    for (unsigned i_distribution = 0; i_distribution < 4; ++i_distribution)
+    {
+        srand(i_distribution + 1);
+        ScoreAccumulator acc;
+        acc.resize(i_nbSlots);
+        vector<SearchResult> scored;
+        for (unsigned i_slot = 0; i_slot < i_nbSlots; ++i_slot)
+        {
+            const float f_score = getScore(i_distribution, i_slot);
+            if (f_score == 0)
+                continue;
+            acc.add(i_slot, f_score);
+            scored.push_back(SearchResult(f_score, i_slot, Rect()));
+        }
+
+        double f_sortTime = HUGE_VAL, f_queueTime = HUGE_VAL, f_topKTime = HUGE_VAL;
+        vector<float> sortedScores, topKScores;
+        for (unsigned i_run = 0; i_run < NB_RUNS; ++i_run)
+        {
+            // Full sort of the scored slots.
+            timeval t;
+            gettimeofday(&t, NULL);
+            vector<SearchResult> results(scored);
+            sort(results.rbegin(), results.rend());
+            results.resize(min((size_t)k, results.size()), SearchResult(0, 0, Rect()));
+            f_sortTime = min(f_sortTime, getElapsedTime(t));
+
+            sortedScores.clear();
+            for (unsigned i = 0; i < results.size(); ++i)
+                sortedScores.push_back(results[i].f_weight);
+
+            // Push of all the scored slots in a priority queue, as before the bounded selection.
+            gettimeofday(&t, NULL);
+            priority_queue<SearchResult> queue;
+            for (unsigned i = 0; i < scored.size(); ++i)
+                queue.push(scored[i]);
+            for (unsigned i = 0; i < k && !queue.empty(); ++i)
+                queue.pop();
+            f_queueTime = min(f_queueTime, getElapsedTime(t));
+
+            gettimeofday(&t, NULL);
+            acc.getFirstResults(k, results);
+            f_topKTime = min(f_topKTime, getElapsedTime(t));
+
+            topKScores.clear();
+            for (unsigned i = 0; i < results.size(); ++i)
+                topKScores.push_back(results[i].f_weight);
+        }
+
+        cout << distributions[i_distribution] << "\t" << scored.size() << "\t"
+             << f_sortTime << "\t" << f_queueTime << "\t" << f_topKTime
+             << (topKScores == sortedScores ? "" : "\tMISMATCH") << endl;
+    }
+
+    return 0;
+}
@@ -23,9 +23,14 @@
 #define PASTEC_BACKWARDINDEXREADERACCESS_H
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <cstring>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <fstream>
@@ -161,4 +166,101 @@ private:
     u_int64_t i_curPos;
 };
 
+
+/**
+ * @brief Access to a backward index file mapped in memory.
+ * The file pages are served from the page cache so that the index hits can be
+ * read in place and shared between several processes.
+ */
+class BackwardIndexReaderMmapAccess : public BackwardIndexReaderAccess
+{
+public:
+    BackwardIndexReaderMmapAccess()
+        : p_indexData(NULL), i_fileSize(0), i_curPos(0) {}
+
+    virtual ~BackwardIndexReaderMmapAccess()
+    {
+        close();
+    }
+
+    virtual bool open(string indexPath)
+    {
+        int fd = ::open(indexPath.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        i_fileSize = fileStat.st_size;
+
+        void *p_map = mmap(NULL, i_fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping stays valid after the file descriptor is closed.
+        ::close(fd);
+        if (p_map == MAP_FAILED)
+        {
+            cout << "Couldn't map the backward index file in memory." << endl;
+            return false;
+        }
+
+        p_indexData = (const char *)p_map;
+        i_curPos = 0;
+        return true;
+    }
+
+    virtual void moveAt(u_int64_t pos)
+    {
+        i_curPos = pos;
+    }
+
+    virtual void read(char *p_data, unsigned i_nbBytes)
+    {
+        // Never read past the end of the mapping.
+        if (i_nbBytes > 0 && i_curPos < i_fileSize)
+            memcpy(p_data, p_indexData + i_curPos,
+                   min((u_int64_t)i_nbBytes, i_fileSize - i_curPos));
+        i_curPos += i_nbBytes;
+    }
+
+    virtual bool endOfIndex()
+    {
+        return i_curPos > i_fileSize;
+    }
+
+    virtual void reset()
+    {
+        i_curPos = 0;
+    }
+
+    virtual void close()
+    {
+        if (p_indexData != NULL)
+            munmap((void *)p_indexData, i_fileSize);
+        p_indexData = NULL;
+        i_fileSize = 0;
+    }
+
+    /**
+     * @brief Return a pointer to the mapped file content.
+     * @param pos the position in the file.
+     */
+    const char *getData(u_int64_t pos) const
+    {
+        return p_indexData + pos;
+    }
+
+    u_int64_t getSize() const
+    {
+        return i_fileSize;
+    }
+
+private:
+    const char *p_indexData;
+    u_int64_t i_fileSize;
+    u_int64_t i_curPos;
+};
+
 #endif // PASTEC_BACKWARDINDEXREADERACCESS_H
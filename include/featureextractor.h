@@ -23,6 +23,9 @@
 #define PASTEC_FEATUREEXTRACTOR_H
 
 #include <sys/types.h>
+#include <vector>
+
+using namespace std;
 
 
 class FeatureExtractor
@@ -30,6 +33,11 @@ class FeatureExtractor
 public:
     virtual u_int32_t processNewImage(unsigned i_imageId, unsigned i_imgSize,
                                       char *p_imgData, unsigned &i_nbFeaturesExtracted) = 0;
+    virtual u_int32_t processNewImages(const vector<unsigned> &imageIds,
+                                       const vector<unsigned> &imgSizes,
+                                       const vector<char *> &imgData,
+                                       vector<u_int32_t> &results,
+                                       vector<unsigned> &nbFeaturesExtracted) = 0;
 };
 
 #endif // PASTEC_FEATUREEXTRACTOR_H
@@ -24,13 +24,24 @@
 
 #include <sys/types.h>
 
+#include <cstddef>
+#include <vector>
+
+#include <postingcodec.h>
+
+using namespace std;
+
+
+/* The hit layout matches exactly the one of an entry of the backward index file
+ * so that the hits of a memory mapped index can be read in place.
+ * In the index, i_imageId holds the slot of the image instead of its id. */
 struct Hit
 {
     u_int32_t i_imageId;
     u_int16_t i_angle;
     u_int16_t x;
     u_int16_t y;
-};
+} __attribute__((packed));
 
 struct HitForward
 {
@@ -41,4 +52,164 @@ struct HitForward
     u_int16_t y;
 };
 
+
+/**
+ * @brief A read-only view on a contiguous array of hits.
+ * The hits can either belong to a vector or to a memory mapped index file.
+ */
+struct HitSpan
+{
+    HitSpan() : p_hits(NULL), i_nbHits(0) {}
+    HitSpan(const Hit *p_hits, u_int64_t i_nbHits)
+        : p_hits(p_hits), i_nbHits(i_nbHits) {}
+    HitSpan(const vector<Hit> &hits)
+        : p_hits(hits.data()), i_nbHits(hits.size()) {}
+
+    const Hit *begin() const { return p_hits; }
+    const Hit *end() const { return p_hits + i_nbHits; }
+    u_int64_t size() const { return i_nbHits; }
+    bool empty() const { return i_nbHits == 0; }
+    const Hit &operator[](u_int64_t i) const { return p_hits[i]; }
+
+    const Hit *p_hits;
+    u_int64_t i_nbHits;
+};
+
+
+// The position and the orientation of a hit stored apart from its image id.
+struct HitPayload
+{
+    u_int16_t i_angle;
+    u_int16_t x;
+    u_int16_t y;
+} __attribute__((packed));
+
+
+/* A hit of the forward store of an image: its word and its payload.
+ * The hits of an image are sorted by word id. */
+struct ForwardHit
+{
+    u_int32_t i_wordId;
+    u_int16_t i_angle;
+    u_int16_t x;
+    u_int16_t y;
+
+    bool operator< (const ForwardHit &rhs) const
+    {
+        return i_wordId < rhs.i_wordId;
+    }
+} __attribute__((packed));
+
+typedef vector<ForwardHit> ForwardHits;
+
+
+/**
+ * @brief A read-only view on hits whose image ids are compressed.
+ * The image ids are sorted and encoded with PostingCodec. The payloads
+ * are stored in a separate array in the same order.
+ */
+struct PackedHitSpan
+{
+    PackedHitSpan() : p_ids(NULL), p_payloads(NULL), i_nbHits(0) {}
+    PackedHitSpan(const u_int8_t *p_ids, const HitPayload *p_payloads,
+                  u_int64_t i_nbHits)
+        : p_ids(p_ids), p_payloads(p_payloads), i_nbHits(i_nbHits) {}
+
+    u_int64_t size() const { return i_nbHits; }
+    bool empty() const { return i_nbHits == 0; }
+    void decodeImageIds(u_int32_t *p_imageIds) const
+    {
+        PostingCodec::decode(p_ids, i_nbHits, p_imageIds);
+    }
+
+    const u_int8_t *p_ids;
+    const HitPayload *p_payloads;
+    u_int64_t i_nbHits;
+};
+
+
+#define NB_HIT_SEGMENTS 3
+#define BASE_SEGMENT 0
+#define DELTA_SEGMENT 1
+#define FROZEN_DELTA_SEGMENT 2
+
+/**
+ * @brief The hits of a word in the index.
+ * They are split between the immutable base segment and the delta segment
+ * that receives the modifications. While a merge builds a new base segment,
+ * the previous delta segment is frozen and its hits are in
+ * segments[FROZEN_DELTA_SEGMENT]. When the image ids of the base segment
+ * are compressed, its hits are in packedBase instead of segments[BASE_SEGMENT].
+ */
+struct WordHits
+{
+    u_int64_t size() const
+    {
+        u_int64_t i_size = packedBase.size();
+        for (unsigned i = 0; i < NB_HIT_SEGMENTS; ++i)
+            i_size += segments[i].size();
+        return i_size;
+    }
+
+    /**
+     * @brief Append all the hits to a vector, decoding the compressed ones.
+     * @param hits the vector.
+     */
+    void getHits(vector<Hit> &hits) const
+    {
+        if (!packedBase.empty())
+        {
+            vector<u_int32_t> imageIds(packedBase.size());
+            packedBase.decodeImageIds(imageIds.data());
+            for (u_int64_t i = 0; i < imageIds.size(); ++i)
+            {
+                Hit hit;
+                hit.i_imageId = imageIds[i];
+                hit.i_angle = packedBase.p_payloads[i].i_angle;
+                hit.x = packedBase.p_payloads[i].x;
+                hit.y = packedBase.p_payloads[i].y;
+                hits.push_back(hit);
+            }
+        }
+        for (unsigned i = 0; i < NB_HIT_SEGMENTS; ++i)
+            hits.insert(hits.end(), segments[i].begin(), segments[i].end());
+    }
+
+    /**
+     * @brief Find the hit of an image.
+     * @param i_imageId the image id.
+     * @param hit the returned hit.
+     * @return true if the image has this word else false.
+     */
+    bool find(u_int32_t i_imageId, Hit &hit) const
+    {
+        if (!packedBase.empty())
+        {
+            vector<u_int32_t> imageIds(packedBase.size());
+            packedBase.decodeImageIds(imageIds.data());
+            for (u_int64_t i = 0; i < imageIds.size(); ++i)
+                if (imageIds[i] == i_imageId)
+                {
+                    hit.i_imageId = i_imageId;
+                    hit.i_angle = packedBase.p_payloads[i].i_angle;
+                    hit.x = packedBase.p_payloads[i].x;
+                    hit.y = packedBase.p_payloads[i].y;
+                    return true;
+                }
+        }
+
+        for (unsigned i = 0; i < NB_HIT_SEGMENTS; ++i)
+            for (const Hit *it = segments[i].begin(); it != segments[i].end(); ++it)
+                if (it->i_imageId == i_imageId)
+                {
+                    hit = *it;
+                    return true;
+                }
+        return false;
+    }
+
+    PackedHitSpan packedBase;
+    HitSpan segments[NB_HIT_SEGMENTS];
+};
+
 #endif // PASTEC_HIT_H
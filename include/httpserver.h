@@ -24,6 +24,7 @@
 
 #include <vector>
 #include <string>
+#include <map>
 #include <microhttpd.h>
 
 using namespace std;
@@ -54,6 +55,8 @@ private:
     static void requestCompleted(void *cls, MHD_Connection *connection,
                                  void **con_cls, MHD_RequestTerminationCode toe);
     static int sendAnswer(struct MHD_Connection *connection, ConnectionInfo &conInfo);
+    static int readArgument(void *cls, enum MHD_ValueKind kind,
+                            const char *key, const char *value);
     static int readAuthHeader(void *cls, enum MHD_ValueKind kind,
                               const char *key, const char *value);
 
@@ -77,6 +80,7 @@ struct ConnectionInfo
     string answerString;
     int answerCode;
     string authKey;
+    map<string, string> arguments; // The arguments of the query string.
 
     vector<char> uploadedData;
 };
@@ -27,45 +27,45 @@
 #include <queue>
 #include <list>
 #include <unordered_map>
-#include <unordered_set>
+#include <memory>
+#include <atomic>
 
 #include <opencv2/core/core.hpp>
 
-#include <thread.h>
+#include <threadpool.h>
+#include <workstealingqueues.h>
 #include <searchResult.h>
 #include <hit.h>
+#include <rigidtransformverifier.h>
 
 using namespace std;
 using namespace cv;
 
 
-class ImageReranker
-{
-public:
-    ImageReranker() {}
-    void rerank(std::unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
-                std::unordered_map<u_int32_t, vector<Hit> > &indexHits,
-                priority_queue<SearchResult> &rankedResultsIn,
-                priority_queue<SearchResult> &rankedResultsOut,
-                unsigned i_nbResults);
-
-private:
-    float angleDiff(unsigned i_angle1, unsigned i_angle2);
-    void getFirstImageIds(priority_queue<SearchResult> &rankedResultsIn,
-                          unsigned i_nbResults, unordered_set<u_int32_t> &firstImageIds);
-};
-
-
 // A task that must be performed when the rerankRANSAC function is called.
 struct RANSACTask
 {
     vector<Point2f> points1;
     vector<Point2f> points2;
+    vector<float> qualities; // Only set for the PROSAC sampling.
+    vector<float> rotations; // Only set for the pose voting.
 };
 
 
 #define HISTOGRAM_NB_BINS 32
-#define DIFF_MIN -360.0f / (2.0f * HISTOGRAM_NB_BINS)
+// The width of a bin in 16 bit angle units.
+#define HISTOGRAM_BIN_WIDTH ((1 << 16) / HISTOGRAM_NB_BINS)
+
+// An image is verified if the peak of its histogram holds more correspondences.
+#define HISTOGRAM_MIN_PEAK 10
+/* Number of bins kept on each side of the peak: only the correspondences
+ * of these dominant bins are verified. */
+#define HISTOGRAM_PEAK_HALF_WIDTH 1
+/* An image is accepted without RANSAC if its dominant bins hold at least
+ * HISTOGRAM_DECISIVE_MIN_NB correspondences and HISTOGRAM_DECISIVE_RATIO
+ * of all its correspondences. */
+#define HISTOGRAM_DECISIVE_MIN_NB 100
+#define HISTOGRAM_DECISIVE_RATIO 0.6f
 
 
 struct Histogram
@@ -80,32 +80,220 @@ struct Histogram
 };
 
 
-#define RANSAC_MIN_INLINERS 12
+/**
+ * @brief Return the histogram bin of the rotation between two keypoints.
+ * The first bin is centered on the null rotation.
+ * @param i_angle1 the 16 bit angle of the first keypoint.
+ * @param i_angle2 the 16 bit angle of the second keypoint.
+ */
+inline unsigned getHistogramBin(u_int16_t i_angle1, u_int16_t i_angle2)
+{
+    return (u_int16_t)(i_angle1 - i_angle2 + HISTOGRAM_BIN_WIDTH / 2) / HISTOGRAM_BIN_WIDTH;
+}
+
+
+/* A hit of a candidate image that matches a hit of the request. The points
+ * of the verification are only built for the candidates that have a clear
+ * histogram peak. */
+struct Correspondence
+{
+    u_int32_t i_rank;
+    u_int32_t i_requestHit; // The position of the hit in the request hits.
+    u_int16_t i_angle;
+    u_int16_t x;
+    u_int16_t y;
+} __attribute__((packed));
+
+
+// Marks the candidates whose correspondences are not verified.
+#define RERANKING_NO_PEAK 0xFF
+
+
+// Marks the free entries of the lookup table of the candidate images.
+#define RERANKING_TABLE_EMPTY 0xFFFFFFFF
+
+
+/**
+ * @brief The data of the images to rerank indexed by their rank.
+ * The ranks of the images are found with a small open addressing table
+ * that is at most a quarter full. The arrays are only grown so a table
+ * can be reused by the successive requests without any allocation.
+ */
+class RerankingTable
+{
+public:
+    RerankingTable() : i_mask(0), i_shift(32) { }
+
+    void reset(const vector<SearchResult> &rankedResults);
+
+    /**
+     * @brief Return the rank of an image or RERANKING_TABLE_EMPTY if it
+     * is not a candidate.
+     */
+    u_int32_t getRank(u_int32_t i_imageId) const
+    {
+        u_int32_t i_entry = hash(i_imageId);
+        while (entries[i_entry].i_imageId != i_imageId)
+        {
+            if (entries[i_entry].i_rank == RERANKING_TABLE_EMPTY)
+                return RERANKING_TABLE_EMPTY;
+            i_entry = (i_entry + 1) & i_mask;
+        }
+        return entries[i_entry].i_rank;
+    }
+
+    unsigned getNbCandidates() const { return imageIds.size(); }
+    u_int32_t getImageId(u_int32_t i_rank) const { return imageIds[i_rank]; }
+    Histogram &getHistogram(u_int32_t i_rank) { return histograms[i_rank]; }
+    RANSACTask &getTask(u_int32_t i_rank) { return tasks[i_rank]; }
+
+    // Buffers used to gather the hits of the candidates.
+    vector<u_int32_t> decodedImageIds;
+    ForwardHits requestHits; // Sorted by word id.
+    vector<float> requestQualities;
+    vector<Correspondence> correspondences;
+    vector<u_int8_t> peakBins; // The histogram peak of each candidate or RERANKING_NO_PEAK.
+
+private:
+    struct Entry
+    {
+        u_int32_t i_imageId;
+        u_int32_t i_rank;
+    };
+
+    u_int32_t hash(u_int32_t i_imageId) const
+    {
+        // Fibonacci hashing: the high bits of the product are the best mixed.
+        return (u_int32_t)((u_int64_t)(i_imageId * 2654435761u) >> i_shift);
+    }
+
+    vector<Entry> entries;
+    u_int32_t i_mask;
+    unsigned i_shift;
+    vector<u_int32_t> imageIds;
+    vector<Histogram> histograms;
+    vector<RANSACTask> tasks;
+};
+
+
+// The counts of the verification of a request, logged in the check mode.
+struct VerificationCounts
+{
+    VerificationCounts()
+        : i_nbImages(0), i_nbDecisiveImages(0), i_nbCheckErrors(0), i_nbDecisiveErrors(0)
+    { }
+
+    unsigned i_nbImages;
+    unsigned i_nbDecisiveImages;
+    unsigned i_nbCheckErrors;
+    unsigned i_nbDecisiveErrors;
+};
+
+
+/* In the first match mode, the candidates are processed by batches of
+ * growing size, starting with this one. */
+#define FIRST_MATCH_FIRST_BATCH_SIZE 8
 
 
-class RANSACThread : public Thread
+class ImageReranker
 {
 public:
-    RANSACThread(pthread_mutex_t &mutex,
-                 std::unordered_map<u_int32_t, RANSACTask> &imgTasks,
-                 priority_queue<SearchResult> &rankedResultsOut)
-        : mutex(mutex), imgTasks(imgTasks), rankedResultsOut(rankedResultsOut)
+    ImageReranker(ThreadPool *threadPool, bool checkVerification, bool prosacSampling,
+                  bool adaptiveRansac, bool poseVoting);
+    ~ImageReranker();
+    void rerank(std::unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
+                std::unordered_map<u_int32_t, WordHits> &indexHits,
+                const vector<SearchResult> &rankedResultsIn,
+                const vector<shared_ptr<const ForwardHits> > &forwardHits,
+                const std::unordered_map<u_int32_t, float> &wordQualities,
+                unsigned i_firstMatchMinScore,
+                priority_queue<SearchResult> &rankedResultsOut);
+
+private:
+    void addCorrespondence(RerankingTable &table, u_int32_t i_rank, u_int32_t i_requestHit,
+                           u_int16_t i_requestAngle, u_int16_t i_angle, u_int16_t x, u_int16_t y);
+    float getWordQuality(const std::unordered_map<u_int32_t, float> &wordQualities,
+                         u_int32_t i_wordId);
+    void setRequestHits(RerankingTable &table,
+                        std::unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
+                        const std::unordered_map<u_int32_t, float> &wordQualities);
+    void gatherFromPostings(RerankingTable &table,
+                            std::unordered_map<u_int32_t, WordHits> &indexHits);
+    void gatherFromForwardHits(RerankingTable &table,
+                               const vector<shared_ptr<const ForwardHits> > &forwardHits,
+                               u_int32_t i_begin, u_int32_t i_end);
+    void selectPeaks(RerankingTable &table, u_int32_t i_begin, u_int32_t i_end);
+    void buildPoints(RerankingTable &table);
+    bool verifyCandidates(RerankingTable &table, u_int32_t i_begin, u_int32_t i_end,
+                          unsigned i_firstMatchMinScore,
+                          priority_queue<SearchResult> &rankedResultsOut,
+                          VerificationCounts &counts);
+    RerankingTable *acquireTable();
+    void releaseTable(RerankingTable *table);
+
+    ThreadPool *threadPool;
+    bool checkVerification;
+    bool prosacSampling; // Sample the best correspondences first.
+    bool adaptiveRansac; // Bound the number of transforms by the number of correspondences.
+    bool poseVoting; // Verify with a Hough transform instead of RANSAC.
+
+    // The tables are kept between the requests.
+    vector<RerankingTable *> freeTables;
+    pthread_mutex_t tablesMutex;
+};
+
+
+// The images to rerank are split in NB_RANSAC_TASKS tasks of the thread pool.
+#define NB_RANSAC_TASKS 4
+
+
+// An image whose correspondences must be verified.
+struct RerankingCandidate
+{
+    u_int32_t i_imageId;
+    float f_weight;
+    RANSACTask *task;
+    bool b_decisive; // Accepted without RANSAC.
+};
+
+
+class RerankingTask : public PoolTask
+{
+public:
+    RerankingTask(pthread_mutex_t &mutex,
+                  WorkStealingQueues<RerankingCandidate> &candidates, unsigned i_queue,
+                  priority_queue<SearchResult> &rankedResultsOut, bool checkVerification,
+                  bool prosacSampling, bool adaptiveRansac, bool poseVoting,
+                  unsigned i_firstMatchMinScore, atomic<bool> &b_matchFound)
+        : mutex(mutex), candidates(candidates), i_queue(i_queue),
+          rankedResultsOut(rankedResultsOut), checkVerification(checkVerification),
+          poseVoting(poseVoting), i_firstMatchMinScore(i_firstMatchMinScore),
+          b_matchFound(b_matchFound), i_nbCheckErrors(0), i_nbDecisiveErrors(0),
+          verifier(adaptiveRansac || prosacSampling, prosacSampling)
     { }
 
 public:
-    void *run();
+    void run();
 
     pthread_mutex_t &mutex;
-    std::unordered_map<u_int32_t, RANSACTask> &imgTasks;
+    WorkStealingQueues<RerankingCandidate> &candidates;
+    unsigned i_queue;
     priority_queue<SearchResult> &rankedResultsOut;
-    deque<unsigned> imageIds;
-    deque<Histogram> histograms;
+    bool checkVerification; // Compare the verifier with pastecEstimateRigidTransform.
+    bool poseVoting;
+    unsigned i_firstMatchMinScore; // 0 to verify all the candidates.
+    atomic<bool> &b_matchFound; // Set to stop all the tasks at the first match.
+    unsigned i_nbCheckErrors;
+    unsigned i_nbDecisiveErrors; // The decisive images rejected by the verifier.
+    RigidTransformVerifier verifier;
+
+    // The reference verification, also compared to the verifier by pastec-bench-ransac-check.
+    static cv::Mat pastecEstimateRigidTransform(InputArray src1, InputArray src2,
+                                                bool fullAffine);
 
 private:
-    void getRTMatrix(const Point2f* a, const Point2f* b,
-                     int count, Mat& M, bool fullAffine);
-    cv::Mat pastecEstimateRigidTransform(InputArray src1, InputArray src2,
-                                         bool fullAffine);
+    static void getRTMatrix(const Point2f* a, const Point2f* b,
+                            int count, Mat& M, bool fullAffine);
 };
 
 
@@ -47,6 +47,7 @@ enum MessagesOut
     IMAGE_REMOVED =                     0x10050900,
     IMAGE_TAG_ADDED =                   0x10051000,
     IMAGE_TAG_REMOVED =                 0x10051100,
+    IMAGES_ADDED =                      0x10051200,
 
     INDEX_LOADED =                      0x10060100,
     INDEX_TAGS_LOADED =                 0x10060110,
@@ -95,6 +96,7 @@ public:
             case IMAGE_REMOVED: s = "IMAGE_REMOVED"; break;
             case IMAGE_TAG_ADDED: s = "IMAGE_TAG_ADDED"; break;
             case IMAGE_TAG_REMOVED: s = "IMAGE_TAG_REMOVED"; break;
+            case IMAGES_ADDED: s = "IMAGES_ADDED"; break;
 
             case INDEX_LOADED: s = "INDEX_LOADED"; break;
             case INDEX_TAGS_LOADED: s = "INDEX_TAGS_LOADED"; break;
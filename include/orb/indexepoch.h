@@ -0,0 +1,284 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef PASTEC_INDEXEPOCH_H
+#define PASTEC_INDEXEPOCH_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include <hit.h>
+#include <backwardindexreaderaccess.h>
+
+using namespace std;
+
+
+#define NB_VISUAL_WORDS 1000000
+
+// Removal sequence number of the slots of the live images.
+#define SLOT_NEVER_REMOVED ((u_int64_t)-1)
+
+// The slot table is made of NB_SLOT_CHUNKS chunks of SLOT_CHUNK_SIZE slots.
+#define SLOT_CHUNK_SHIFT 16
+#define SLOT_CHUNK_SIZE (1 << SLOT_CHUNK_SHIFT)
+#define NB_SLOT_CHUNKS (1 << 16)
+
+// Initial number of hits of the posting list of a word in the delta segment.
+#define DELTA_POSTINGS_MIN_CAPACITY 16
+
+// The delta segment is split in NB_INDEX_SHARDS ranges of consecutive words.
+#define NB_INDEX_SHARDS 16
+#define INDEX_SHARD_SIZE ((NB_VISUAL_WORDS + NB_INDEX_SHARDS - 1) / NB_INDEX_SHARDS)
+
+
+/**
+ * @brief The data of an image slot read by the searches.
+ * An image is visible in the snapshots of sequence numbers in
+ * [i_addSeq, i_removeSeq).
+ */
+struct SlotInfo
+{
+    u_int32_t i_imageId;
+    float f_invNbWords;
+    atomic<u_int64_t> i_addSeq;
+    atomic<u_int64_t> i_removeSeq;
+};
+
+
+/**
+ * @brief The table of the image slots.
+ * The slots are stored in chunks that are never moved so that they can be
+ * read without lock while new slots are added. The slots freed by the
+ * merges are given back by the epochs once no reader can see them.
+ */
+class SlotTable
+{
+public:
+    SlotTable();
+    ~SlotTable();
+
+    SlotInfo &getSlot(u_int32_t i_slot) const
+    {
+        return chunks[i_slot >> SLOT_CHUNK_SHIFT].load(memory_order_acquire)
+            [i_slot & (SLOT_CHUNK_SIZE - 1)];
+    }
+
+    u_int32_t getNbSlots() const
+    {
+        return i_nbSlots.load(memory_order_acquire);
+    }
+
+    u_int32_t acquireSlot();
+    void releaseSlots(const vector<u_int32_t> &slots);
+
+private:
+    atomic<SlotInfo *> chunks[NB_SLOT_CHUNKS];
+    atomic<u_int32_t> i_nbSlots;
+    vector<u_int32_t> freeSlots;
+    pthread_mutex_t freeSlotsMutex;
+};
+
+
+/**
+ * @brief The hits of a word in the delta segment.
+ * The hits are only appended. i_nbHits is updated once a hit is written so
+ * that the readers never see a partial hit. When the array is full, it is
+ * replaced by a larger copy and retired.
+ */
+struct DeltaPostings
+{
+    DeltaPostings(u_int32_t i_capacity)
+        : i_capacity(i_capacity), i_nbHits(0), p_hits(new Hit[i_capacity]) { }
+
+    ~DeltaPostings()
+    {
+        delete[] p_hits;
+    }
+
+    u_int32_t i_capacity;
+    atomic<u_int32_t> i_nbHits;
+    Hit *p_hits;
+};
+
+
+// A hit to add to the delta segment.
+struct WordHit
+{
+    u_int32_t i_wordId;
+    Hit hit;
+
+    bool operator< (const WordHit &wordHit) const
+    {
+        return i_wordId < wordHit.i_wordId;
+    }
+};
+
+
+/**
+ * @brief The posting lists of a range of words of the delta segment.
+ * The lock serializes the writers that append hits to the shard.
+ */
+struct DeltaShard
+{
+    DeltaShard();
+    ~DeltaShard();
+
+    atomic<DeltaPostings *> words[INDEX_SHARD_SIZE];
+    pthread_mutex_t mutex;
+};
+
+
+/**
+ * @brief The delta segment that receives the new hits until it is merged.
+ * Several writers can append hits at the same time as long as they do not
+ * touch the same shards.
+ */
+class DeltaSegment
+{
+public:
+    HitSpan getHits(u_int32_t i_wordId) const
+    {
+        const DeltaPostings *postings = shards[i_wordId / INDEX_SHARD_SIZE]
+            .words[i_wordId % INDEX_SHARD_SIZE].load(memory_order_acquire);
+        if (postings == NULL)
+            return HitSpan();
+        return HitSpan(postings->p_hits, postings->i_nbHits.load(memory_order_acquire));
+    }
+
+    void append(const vector<WordHit> &wordHits,
+                vector<DeltaPostings *> &retiredPostings);
+
+private:
+    static void appendToShard(DeltaShard &shard, u_int32_t i_wordId,
+                              vector<WordHit>::const_iterator first,
+                              vector<WordHit>::const_iterator last,
+                              vector<DeltaPostings *> &retiredPostings);
+
+    DeltaShard shards[NB_INDEX_SHARDS];
+};
+
+
+/**
+ * @brief The immutable base segment.
+ * The hits are sorted by word id in a single array.
+ * The hits of the word i are in [offsets[i], offsets[i + 1]).
+ * The array is either hitsBuffer or the memory mapped index file.
+ * When the image ids are compressed, the array is replaced by the
+ * encoded ids of the word i starting at packedOffsets[i] in
+ * packedIds and by the payloads of payloads.
+ */
+struct BaseSegment
+{
+    BaseSegment();
+    ~BaseSegment();
+
+    WordHits getHits(u_int32_t i_wordId) const;
+
+    u_int64_t *offsets;
+    const Hit *hits;
+    Hit *hitsBuffer;
+    u_int64_t *packedOffsets;
+    u_int8_t *packedIds;
+    HitPayload *payloads;
+    BackwardIndexReaderMmapAccess *mappedIndex;
+};
+
+
+/**
+ * @brief A version of the segments of the index.
+ * The readers pin the last published epoch for the duration of a search
+ * and scan its segments in place. The memory retired by the writers while
+ * an epoch is the last published one is freed with the epoch. Each epoch
+ * holds the next one so that an epoch is only freed once all the previous
+ * ones are not used anymore.
+ */
+struct IndexEpoch
+{
+    IndexEpoch(shared_ptr<BaseSegment> base, shared_ptr<DeltaSegment> delta,
+               shared_ptr<SlotTable> slots, u_int64_t i_baseSeq,
+               shared_ptr<DeltaSegment> frozenDelta = shared_ptr<DeltaSegment>())
+        : base(base), delta(delta), frozenDelta(frozenDelta), slots(slots),
+          i_baseSeq(i_baseSeq) { }
+    ~IndexEpoch();
+
+    shared_ptr<BaseSegment> base;
+    shared_ptr<DeltaSegment> delta;
+    shared_ptr<DeltaSegment> frozenDelta; // The delta segment being merged, if any.
+    shared_ptr<SlotTable> slots;
+    u_int64_t i_baseSeq; // The sequence number of the index when the base segment was built.
+
+    vector<DeltaPostings *> retiredPostings;
+    vector<u_int32_t> retiredSlots;
+    shared_ptr<IndexEpoch> next;
+};
+
+
+/**
+ * @brief A consistent view of the index for a search.
+ * The image slots and the hits added or removed after the snapshot has
+ * been taken are ignored.
+ */
+struct IndexSnapshot
+{
+    /**
+     * @brief Test if the image of a slot is in the snapshot.
+     */
+    bool isSlotVisible(u_int32_t i_slot) const
+    {
+        const SlotInfo &slot = epoch->slots->getSlot(i_slot);
+        return slot.i_addSeq.load(memory_order_relaxed) <= i_seq
+            && i_seq < slot.i_removeSeq.load(memory_order_relaxed);
+    }
+
+    /**
+     * @brief Return the inverse of the number of words of the image of a slot.
+     */
+    float getSlotInvNbWords(u_int32_t i_slot) const
+    {
+        return epoch->slots->getSlot(i_slot).f_invNbWords;
+    }
+
+    /**
+     * @brief Return the id of the image of a slot.
+     */
+    u_int32_t getSlotImageId(u_int32_t i_slot) const
+    {
+        return epoch->slots->getSlot(i_slot).i_imageId;
+    }
+
+    /**
+     * @brief Return an upper bound of the slots visible in the snapshot.
+     */
+    u_int32_t getNbSlots() const
+    {
+        return i_nbSlots;
+    }
+
+    shared_ptr<IndexEpoch> epoch;
+    u_int64_t i_seq;
+    u_int32_t i_nbSlots;
+};
+
+#endif // PASTEC_INDEXEPOCH_H
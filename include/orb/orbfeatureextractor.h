@@ -32,6 +32,7 @@
 #include <orbindex.h>
 #include <orbwordindex.h>
 #include <featureextractor.h>
+#include <threadpool.h>
 
 class ClientConnection;
 
@@ -43,15 +44,23 @@ using namespace std;
 class ORBFeatureExtractor : public FeatureExtractor
 {
 public:
-    ORBFeatureExtractor(ORBIndex *index, ORBWordIndex *wordIndex);
+    ORBFeatureExtractor(ORBIndex *index, ORBWordIndex *wordIndex, ThreadPool *threadPool);
     virtual ~ORBFeatureExtractor() {}
 
     u_int32_t processNewImage(unsigned i_imageId, unsigned i_imgSize,
                               char *p_imgData, unsigned &i_nbFeaturesExtracted);
+    u_int32_t processNewImages(const vector<unsigned> &imageIds,
+                               const vector<unsigned> &imgSizes,
+                               const vector<char *> &imgData,
+                               vector<u_int32_t> &results,
+                               vector<unsigned> &nbFeaturesExtracted);
+    u_int32_t extractHits(unsigned i_imageId, unsigned i_imgSize, char *p_imgData,
+                          list<HitForward> &imageHits, unsigned &i_nbFeaturesExtracted);
 
 private:
     ORBIndex *index;
     ORBWordIndex *wordIndex;
+    ThreadPool *threadPool;
     Ptr<ORB> orb;
 };
 
@@ -31,28 +31,85 @@
 #include <vector>
 #include <list>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
 
 #include <hit.h>
 #include <backwardindexreaderaccess.h>
 #include <index.h>
+#include <indexepoch.h>
 
 using namespace std;
 
 
-#define NB_VISUAL_WORDS 1000000
 #define BACKWARD_INDEX_ENTRY_SIZE 10
 
+#define BACKWARD_INDEX_MAGIC "PASTECBI"
+#define BACKWARD_INDEX_VERSION 3
+#define BACKWARD_INDEX_SECTION_ALIGNMENT 4096
+#define BACKWARD_INDEX_FLAG_FORWARD_INDEX 0x1
+
+#define INDEX_LOADING_CHUNK_SIZE (64 << 20)
+
+/* The delta segment is merged into the base segment once it holds, with the
+ * dead hits of the removed images, more than DELTA_MERGE_MIN_NB_HITS hits
+ * and more than 1 / DELTA_MERGE_RATIO of all the hits of the index. */
+#define DELTA_MERGE_MIN_NB_HITS 1000000
+#define DELTA_MERGE_RATIO 10
+
+/* Header of the versions 2 and 3 of the backward index file.
+ * The version 1 files do not have any header and start directly with the
+ * numbers of occurences of the words.
+ * The header is followed by the following sections, each one being aligned
+ * on BACKWARD_INDEX_SECTION_ALIGNMENT bytes:
+ * - the word offsets: i_nbWords + 1 u_int64_t giving the position of the first
+ *   hit of each word in the hit section,
+ * - the images: i_nbImages pairs of u_int32_t (image id, number of words),
+ * - the optional forward index: for each image, in the order of the image
+ *   section, the u_int32_t ids of its words,
+ * - the hits: i_nbHits entries of BACKWARD_INDEX_ENTRY_SIZE bytes sorted
+ *   by word id. Since the version 3, the hits hold the position of their
+ *   image in the image section instead of the image id so that they can be
+ *   used as image slots without any conversion. */
+struct BackwardIndexHeader
+{
+    char magic[8];
+    u_int32_t i_version;
+    u_int32_t i_flags;
+    u_int64_t i_nbWords;
+    u_int64_t i_nbImages;
+    u_int64_t i_nbHits;
+    u_int64_t i_wordOffsetsPos;
+    u_int64_t i_imagesPos;
+    u_int64_t i_forwardIndexPos;
+    u_int64_t i_hitsPos;
+};
+
+// The states of an image slot.
+#define SLOT_FREE 0
+#define SLOT_LIVE 1
+#define SLOT_REMOVED 2
+
+class IndexMergeThread;
+
 class ORBIndex : public Index
 {
 public:
-    ORBIndex(string indexPath, bool buildForwardIndex);
+    ORBIndex(string indexPath, bool buildForwardIndex, bool mapIndexFile,
+             unsigned i_nbLoadingThreads, bool compressImageIds, bool buildForwardHits);
     virtual ~ORBIndex();
-    void getImagesWithVisualWords(std::unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
-                                  std::unordered_map<u_int32_t, vector<Hit> > &indexHitsForReq);
+    void getSnapshot(IndexSnapshot &snapshot);
+    void getImagesWithVisualWords(const IndexSnapshot &snapshot,
+                                  std::unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
+                                  std::unordered_map<u_int32_t, WordHits> &indexHitsForReq);
     unsigned getWordNbOccurences(unsigned i_wordId);
-    unsigned countTotalNbWord(unsigned i_imageId);
+    unsigned getWordMinNbWords(unsigned i_wordId);
     unsigned getTotalNbIndexedImages();
+    bool getSlotForwardHits(const IndexSnapshot &snapshot, const vector<u_int32_t> &slots,
+                            vector<shared_ptr<const ForwardHits> > &forwardHits);
     u_int32_t addImage(unsigned i_imageId, list<HitForward> hitList);
+    u_int32_t addImages(const vector<unsigned> &imageIds,
+                        const vector<list<HitForward> > &hitLists);
     u_int32_t addTag(const unsigned i_imageId, const string tag);
     u_int32_t removeImage(const unsigned i_imageId);
     u_int32_t getImageWords(const unsigned i_imageId, unordered_map<u_int32_t, list<Hit> > &hitList);
@@ -66,20 +123,104 @@ public:
     u_int32_t loadTags(string indexTagsPath);
     u_int32_t writeTags(string indexTagsPath);
 
-    void readLock();
-    void unlock();
+    void mergeDelta();
+    void setAutoMerge(bool b_enabled);
 
 private:
-    u_int64_t nbOccurences[NB_VISUAL_WORDS];
+    WordHits getWordHits(const IndexEpoch &e, unsigned i_wordId);
+    void getLiveWordHits(const IndexEpoch &e, unsigned i_wordId, vector<Hit> &hits);
+    u_int32_t addSlot(u_int32_t i_imageId, unsigned i_nbWords, u_int64_t i_addSeq);
+    u_int32_t reserveSlot(u_int32_t i_imageId, unsigned i_nbWords, u_int64_t i_addSeq);
+    void activateSlot(u_int32_t i_slot, u_int32_t i_imageId, unsigned i_nbWords);
+    void removeSlot(u_int32_t i_slot, u_int64_t i_removeSeq);
+    bool mustMergeDelta();
+    void lowerWordMinNbWords(unsigned i_wordId, unsigned i_nbWords);
+    unsigned getMinNbWords(const vector<Hit> &hits);
+    shared_ptr<const ForwardHits> makeForwardHits(const list<HitForward> &hitList);
+    void publishEpoch(shared_ptr<IndexEpoch> newEpoch);
+    u_int64_t beginWrite();
+    void waitForCommitTurn(u_int64_t i_writeSeq);
+    void endWrite(u_int64_t i_writeSeq);
+    void blockWriters();
+    void unblockWriters();
+    void reset();
+    bool loadVersion1(string backwardIndexPath,
+                      BackwardIndexReaderAccess *indexAccess);
+    bool loadVersion2(string backwardIndexPath,
+                      BackwardIndexReaderAccess *indexAccess,
+                      const BackwardIndexHeader &header);
+    bool loadHits(string backwardIndexPath, u_int64_t i_hitsPos,
+                  unordered_map<u_int32_t, unsigned> *imageNbWords);
+    void convertImageIdsToSlots();
+    void buildForwardIndexFromHits();
+
+    /* The number of hits of each word, including the dead ones.
+     * It is read without lock by the searches. */
+    atomic<u_int64_t> nbOccurences[NB_VISUAL_WORDS];
+    /* The smallest number of words of the images of each word. It is not
+     * raised when an image is removed since the searches that started before
+     * can still see it, so it is only exact after a load. It is read without
+     * lock by the searches. */
+    atomic<unsigned> wordMinNbWords[NB_VISUAL_WORDS];
     u_int64_t totalNbRecords;
     bool buildForwardIndex;
+    bool mapIndexFile;
+    string mappedIndexPath; // The merged hits are written next to this file.
+    unsigned i_nbLoadingThreads; // 0 to use one thread per CPU.
+    bool compressImageIds;
+    bool buildForwardHits;
+    bool b_autoMerge;
+
+    /* The images are stored in dense slots. The hits of the segments hold
+     * the slot of their image instead of its id so that the per image data
+     * are read from flat arrays. A slot is only reused once the hits of its
+     * previous image have been purged and no search can see them anymore.
+     * The data read by the searches are in the slot table of the epoch. */
+    unordered_map<u_int32_t, u_int32_t> imageSlots; // key: image id, value: slot of a live image.
+    vector<u_int8_t> slotStates;
+    vector<unsigned> slotNbWords;
+    vector<string> slotTags;
+    vector<vector<unsigned> > slotWords; // The forward index.
+    /* The hits of the images with their payload, kept for the reranking if
+     * buildForwardHits is set. They are never modified once set so that
+     * the searches can read them without lock. */
+    vector<shared_ptr<const ForwardHits> > slotForwardHits;
+    atomic<unsigned> i_nbImages;
+
+    /* The writers work on epoch and publish it in publishedEpoch for the
+     * searches once they are done. They are the same epoch except while an
+     * index file is being loaded. publishedEpoch is only accessed with the
+     * atomic functions of shared_ptr. */
+    shared_ptr<IndexEpoch> epoch;
+    shared_ptr<IndexEpoch> publishedEpoch;
+
+    /* Each modification of the images gets the sequence number following
+     * i_lastSeq when it starts. The modifications run concurrently but are
+     * committed in the order of their sequence numbers: i_seq is the
+     * sequence number of the last committed one so that the snapshots only
+     * see the complete modifications. */
+    atomic<u_int64_t> i_seq;
+    u_int64_t i_lastSeq;
+    bool b_writersBlocked; // Set while a merge or a reset waits for the running modifications.
+    pthread_cond_t commitCond;
+
+    u_int64_t i_nbDeltaHits;
 
-    unordered_map<u_int64_t, unsigned> nbWords;
-    unordered_map<u_int64_t, vector<unsigned> > forwardIndex;
-    unordered_map<u_int32_t, string> tags;
-    vector<Hit> indexHits[NB_VISUAL_WORDS];
+    /* The hits of the removed images stay in the segments until the next merge
+     * and their slots are in the SLOT_REMOVED state. These dead hits are
+     * skipped by the searches. nbOccurences counts them too while
+     * totalNbRecords does not. */
+    unsigned i_nbRemovedSlots;
+    u_int64_t i_nbDeadHits;
+    IndexMergeThread *mergeThread;
+    bool b_mergeRunning; // Set while a merge builds a new base segment.
 
+    // Protects the image data that are not read by the searches.
     pthread_rwlock_t rwLock;
+    // Protects the sequence numbers, the slot reservations and the epochs.
+    pthread_mutex_t writeMutex;
+    // Serializes the merges, the loads and the resets of the index.
+    pthread_mutex_t mergeMutex;
 };
 
 #endif // PASTEC_ORBINDEX_H
@@ -32,17 +32,42 @@
 #include <orbwordindex.h>
 #include <searchResult.h>
 #include <imagereranker.h>
+#include <scoreaccumulator.h>
+#include <threadpool.h>
 
 using namespace cv;
 using namespace std;
 
 class ClientConnection;
 
+// The words of a request are split in NB_RANKING_TASKS tasks of the thread pool.
+#define NB_RANKING_TASKS 4
+
+/* With an adaptive depth, the reranking stops at the first image of the
+ * tf-idf ranking whose score is under RERANKING_MIN_SCORE_RATIO times the
+ * first one. It also stops at twice the knee of the scores if the curve of
+ * the normalized scores is at RERANKING_MIN_KNEE_DEPTH under its chord
+ * there. At least RERANKING_MIN_NB_IMAGES images are reranked. */
+#define RERANKING_MIN_SCORE_RATIO 0.1f
+#define RERANKING_MIN_KNEE_DEPTH 0.5f
+#define RERANKING_MIN_NB_IMAGES 20
+
+/* The weight of a word probed by a descriptor is exp(-(d^2 - d0^2) / (2 sigma^2))
+ * where d is the Hamming distance of the descriptor to the word and d0 the one
+ * to its nearest word. The words of a lower weight are not probed. */
+#define MULTI_PROBE_SIGMA 16
+#define MULTI_PROBE_MIN_WEIGHT 0.1f
+
+// Relative error allowed on the scores of the pruned ranking.
+#define RANKING_PRUNING_MARGIN 1e-4f
+
 
 class ORBSearcher : public Searcher
 {
 public:
-    ORBSearcher(ORBIndex *index, ORBWordIndex *wordIndex);
+    ORBSearcher(ORBIndex *index, ORBWordIndex *wordIndex, ThreadPool *threadPool,
+                bool prunedRanking, bool checkPrunedRanking, bool checkVerification,
+                bool prosacSampling, bool adaptiveRansac, bool poseVoting);
     virtual ~ORBSearcher();
     u_int32_t searchImage(SearchRequest &request);
     u_int32_t searchSimilar(SearchRequest &request);
@@ -51,13 +76,49 @@ private:
     void returnResults(priority_queue<SearchResult> &rankedResults,
                        SearchRequest &req, unsigned i_maxNbResults);
     unsigned long getTimeDiff(const timeval t1, const timeval t2) const;
+    unsigned getRerankingDepth(const vector<SearchResult> &rankedResults) const;
     u_int32_t processSimilar(SearchRequest &request,
-                             std::unordered_map<u_int32_t, list<Hit> > imageReqHits);
+                             std::unordered_map<u_int32_t, list<Hit> > imageReqHits,
+                             const std::unordered_map<u_int32_t, unsigned> &wordDistances,
+                             const std::unordered_map<u_int32_t, float> &probeWeights);
+    static float getProbeWeight(int i_nearestDist, int i_dist);
+    void getWordWeights(std::unordered_map<u_int32_t, WordHits> &indexHits,
+                        const std::unordered_map<u_int32_t, float> &probeWeights,
+                        unsigned i_nbTotalIndexedImages,
+                        std::unordered_map<u_int32_t, float> &wordWeights);
+    void getWordQualities(std::unordered_map<u_int32_t, WordHits> &indexHits,
+                          const std::unordered_map<u_int32_t, unsigned> &wordDistances,
+                          unsigned i_nbTotalIndexedImages,
+                          std::unordered_map<u_int32_t, float> &wordQualities);
+    ScoreAccumulator *rankImages(const IndexSnapshot &snapshot,
+                                 std::unordered_map<u_int32_t, WordHits> &indexHits,
+                                 const std::unordered_map<u_int32_t, float> &wordWeights,
+                                 const vector<u_int32_t> &wordIds,
+                                 const ScoreAccumulator *candidates);
+    ScoreAccumulator *rankImagesPruned(const IndexSnapshot &snapshot,
+                                       std::unordered_map<u_int32_t, WordHits> &indexHits,
+                                       const std::unordered_map<u_int32_t, float> &wordWeights,
+                                       unsigned k);
+    void checkRanking(const IndexSnapshot &snapshot,
+                      std::unordered_map<u_int32_t, WordHits> &indexHits,
+                      const std::unordered_map<u_int32_t, float> &wordWeights,
+                      const ScoreAccumulator &weights, unsigned k);
+    ScoreAccumulator *acquireAccumulator();
+    void releaseAccumulator(ScoreAccumulator *acc);
 
     ORBIndex *index;
     ORBWordIndex *wordIndex;
+    ThreadPool *threadPool;
     ImageReranker reranker;
     Ptr<ORB> orb;
+    bool prunedRanking;
+    bool checkPrunedRanking; // Compare the pruned ranking with the exhaustive one.
+    bool prosacSampling;
+
+    /* The score accumulators are kept between the requests to avoid
+     * allocating arrays of the size of the index for each of them. */
+    vector<ScoreAccumulator *> freeAccumulators;
+    pthread_mutex_t accumulatorsMutex;
 };
 
 #endif // PASTEC_IMAGESEARCHER_H
@@ -30,6 +30,9 @@
 using namespace cv;
 using namespace std;
 
+// Number of bits of an ORB descriptor and of a visual word.
+#define ORB_DESCRIPTOR_NB_BITS 256
+
 
 class ORBWordIndex
 {
@@ -0,0 +1,49 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef PASTEC_POSTINGCODEC_H
+#define PASTEC_POSTINGCODEC_H
+
+#include <sys/types.h>
+
+// Number of bytes that must be readable after the end of an encoded stream.
+#define POSTING_CODEC_PADDING 16
+
+
+/**
+ * @brief Compression of sorted lists of image ids.
+ * The ids are delta encoded then written with the StreamVByte format:
+ * a two bits code per id giving its number of bytes minus one, packed in
+ * control bytes of four codes, followed by the data bytes of all the ids.
+ * The decoding uses SSSE3 when the CPU supports it.
+ */
+class PostingCodec
+{
+public:
+    static u_int64_t maxEncodedSize(u_int64_t i_nbIds);
+    static u_int64_t encodedSize(const u_int32_t *p_ids, u_int64_t i_nbIds);
+    static u_int64_t encode(const u_int32_t *p_ids, u_int64_t i_nbIds,
+                            u_int8_t *p_out);
+    static void decode(const u_int8_t *p_in, u_int64_t i_nbIds,
+                       u_int32_t *p_ids);
+};
+
+#endif // PASTEC_POSTINGCODEC_H
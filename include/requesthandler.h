@@ -28,6 +28,7 @@
 class FeatureExtractor;
 class Searcher;
 class Index;
+struct SearchRequest;
 
 using namespace std;
 
@@ -47,6 +48,12 @@ public:
 private:
     vector<string> parseURI(string uri);
     bool testURIWithPattern(vector<string> parsedURI, string p_pattern[]);
+    u_int32_t parseImageBatch(vector<char> &data, vector<unsigned> &imageIds,
+                              vector<unsigned> &imgSizes, vector<char *> &imgData);
+    u_int32_t parseSearchParameters(const ConnectionInfo &conInfo, SearchRequest &req);
+    bool parseUnsignedArgument(const ConnectionInfo &conInfo, string name,
+                               unsigned i_max, unsigned &i_value);
+    bool parseBoolArgument(const ConnectionInfo &conInfo, string name, bool &b_value);
     string JsonToString(Json::Value data);
     Json::Value StringToJson(string str);
 
@@ -0,0 +1,152 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#ifndef PASTEC_RIGIDTRANSFORMVERIFIER_H
+#define PASTEC_RIGIDTRANSFORMVERIFIER_H
+
+#include <sys/types.h>
+
+#include <vector>
+#include <utility>
+
+#include <opencv2/core/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+// Number of correspondences that must agree with a transform to accept an image.
+#define RANSAC_MIN_INLINERS 12
+
+#define RANSAC_MAX_NB_ITERATIONS 5000
+
+/* Probability to draw a sample of inliers of a transform supported by
+ * RANSAC_MIN_INLINERS correspondences before stopping. */
+#define RANSAC_CONFIDENCE 0.99
+#define RANSAC_MIN_NB_MODELS 50
+
+// Squared distance under which a projected point is an inlier.
+#define RANSAC_MAX_SQUARED_ERROR 9.0f
+
+// Number of draws of a point of a PROSAC sample before giving up the sample.
+#define PROSAC_MAX_NB_DRAWS 100
+
+/* The bins of the pose voting: 30 degrees of rotation, half an octave of
+ * scale from 1/4 to 4 and a quarter of the size of the first image at the
+ * scale of the bin for the translation. */
+#define HOUGH_NB_ROTATION_BINS 12
+#define HOUGH_NB_SCALE_BINS 8
+#define HOUGH_MIN_LOG_SCALE -2.0f
+#define HOUGH_LOG_SCALE_BIN_SIZE 0.5f
+#define HOUGH_NB_TRANSLATION_BINS 4
+#define HOUGH_MIN_TRANSLATION_BIN_SIZE 8.0f
+
+// The key of a bin: 4 bits of rotation, 3 bits of scale and 12 bits per translation.
+#define HOUGH_TRANSLATION_BITS 12
+#define HOUGH_SCALE_BITS 3
+#define HOUGH_SCALE_SHIFT (2 * HOUGH_TRANSLATION_BITS)
+#define HOUGH_ROTATION_SHIFT (HOUGH_SCALE_SHIFT + HOUGH_SCALE_BITS)
+
+// Number of votes of a bin to refine its transform and number of refined bins.
+#define HOUGH_MIN_NB_VOTES 3
+#define HOUGH_NB_PEAKS 4
+
+
+/**
+ * @brief Faster version of RerankingTask::pastecEstimateRigidTransform for
+ * full affine transforms.
+ * The samples and the tests are the same: the random generator gives the
+ * same sequence as cv::RNG. The points are stored in arrays of coordinates
+ * reused between the images so that the inliers are counted with SIMD
+ * instructions, the bounding rectangle of the points is computed once and
+ * the transforms are solved in closed form. With adaptiveNbIterations, the
+ * number of tested transforms is bounded by the one needed to find a
+ * transform supported by RANSAC_MIN_INLINERS correspondences with a
+ * probability of RANSAC_CONFIDENCE instead of RANSAC_MAX_NB_ITERATIONS.
+ * This bound can miss some weak matches (see benchmarks/ransaccheck.txt).
+ * In the PROSAC mode, the correspondences are sorted by decreasing quality
+ * and the samples are drawn from the best ones first, the set of drawn
+ * correspondences growing to all of them as in Chum and Matas, "Matching
+ * with PROSAC - progressive sample consensus", CVPR 2005. The bound sets
+ * the length of this growth, so the reranker always uses it with PROSAC.
+ * verifyPose finds the transforms with a Hough transform on the poses given
+ * by the rotations of the keypoints instead of random samples.
+ */
+class RigidTransformVerifier
+{
+public:
+    RigidTransformVerifier(bool adaptiveNbIterations = false, bool prosacSampling = false)
+        : adaptiveNbIterations(adaptiveNbIterations), prosacSampling(prosacSampling),
+          i_nbIterations(0) { }
+
+    bool verify(const vector<Point2f> &src1, const vector<Point2f> &src2,
+                const vector<float> &qualities, double M[6]);
+    bool verifyPose(const vector<Point2f> &src1, const vector<Point2f> &src2,
+                    const vector<float> &rotations, double M[6]);
+
+    /**
+     * @brief Return the number of iterations of the last verification or
+     * the number of refined bins for the pose voting.
+     */
+    unsigned getNbIterations() const { return i_nbIterations; }
+
+private:
+    struct RandomGenerator
+    {
+        RandomGenerator() : i_state((u_int64_t)-1) { }
+
+        // The multiply with carry generator of cv::RNG.
+        int uniform(int a, int b)
+        {
+            i_state = (u_int64_t)(unsigned)i_state * 4164903690U + (unsigned)(i_state >> 32);
+            return a == b ? a : (int)((unsigned)i_state % (b - a) + a);
+        }
+
+        u_int64_t i_state;
+    };
+
+    void loadPoints(const vector<Point2f> &src1, const vector<Point2f> &src2);
+    u_int32_t getPoseBin(unsigned i, unsigned i_scaleBin, float f_scale, float f_binSize) const;
+    unsigned getMaxNbModels(unsigned i_nbPoints) const;
+    bool checkTransformedRect(const double M[6]) const;
+    unsigned countInliers(const double M[6], unsigned i_nbPoints) const;
+    bool fitInliers(const double M[6], unsigned i_nbPoints, float f_maxSquaredError,
+                    double fittedM[6]);
+
+    bool adaptiveNbIterations;
+    bool prosacSampling;
+    unsigned i_nbIterations;
+    vector<unsigned> order;
+
+    // The coordinates of the points, padded to a multiple of 8 points.
+    vector<float> ax, ay, bx, by;
+    Point2f rectPoints[4];
+
+    // The buffers of the pose voting.
+    vector<float> pointRotations; // In [0, 360).
+    vector<float> pointCos, pointSin;
+    vector<u_int32_t> votes;
+    vector<u_int32_t> pointBins;
+    vector<pair<unsigned, u_int32_t> > peaks; // The number of votes and the key of the bins.
+};
+
+#endif // PASTEC_RIGIDTRANSFORMVERIFIER_H
@@ -0,0 +1,86 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef PASTEC_SCOREACCUMULATOR_H
+#define PASTEC_SCOREACCUMULATOR_H
+
+#include <sys/types.h>
+
+#include <vector>
+
+#include <searchResult.h>
+
+using namespace std;
+
+// The slots are tracked by blocks of SCORE_BLOCK_SIZE consecutive slots.
+#define SCORE_BLOCK_SHIFT 6
+#define SCORE_BLOCK_SIZE (1 << SCORE_BLOCK_SHIFT)
+
+
+/**
+ * @brief Dense array of image scores indexed by image slot.
+ * The touched slots are recorded in a bitmask per block of slots and the
+ * list of the touched blocks so that the reduction and the reset only visit
+ * these blocks. The arrays are only allocated when the number of slots
+ * grows so an accumulator can be reused by the successive requests.
+ */
+class ScoreAccumulator
+{
+public:
+    ScoreAccumulator() { }
+
+    void resize(u_int32_t i_nbSlots);
+
+    /**
+     * @brief Add a weight to the score of a slot.
+     */
+    void add(u_int32_t i_slot, float f_weight)
+    {
+        const u_int32_t i_block = i_slot >> SCORE_BLOCK_SHIFT;
+        if (touchedMasks[i_block] == 0)
+            touchedBlocks.push_back(i_block);
+        touchedMasks[i_block] |= (u_int64_t)1 << (i_slot & (SCORE_BLOCK_SIZE - 1));
+        scores[i_slot] += f_weight;
+    }
+
+    /**
+     * @brief Test if a weight was added to the score of a slot.
+     */
+    bool isTouched(u_int32_t i_slot) const
+    {
+        return (touchedMasks[i_slot >> SCORE_BLOCK_SHIFT]
+                >> (i_slot & (SCORE_BLOCK_SIZE - 1))) & 1;
+    }
+
+    void reduce(ScoreAccumulator &acc);
+    unsigned getFirstResults(unsigned k, vector<SearchResult> &results) const;
+    unsigned countScoresAbove(float f_minScore, unsigned i_maxCount) const;
+    float getKthScore(unsigned k) const;
+    void prune(float f_minScore);
+    void reset();
+
+private:
+    vector<float> scores;
+    vector<u_int64_t> touchedMasks; // A bit per slot of each block.
+    vector<u_int32_t> touchedBlocks;
+};
+
+#endif // PASTEC_SCOREACCUMULATOR_H
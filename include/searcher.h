@@ -33,11 +33,54 @@ using namespace cv;
 class ClientConnection;
 
 
+// The default and maximal numbers of reranked images and of results of a search.
+#define DEFAULT_NB_RERANKED_IMAGES 300
+#define MAX_NB_RERANKED_IMAGES 2000
+#define DEFAULT_NB_RESULTS 100
+#define MAX_NB_RESULTS 1000
+
+/* In the first match mode, the verification stops at the first image whose
+ * score, the number of correspondences of its histogram peak, reaches this
+ * threshold. */
+#define DEFAULT_FIRST_MATCH_MIN_SCORE 30
+#define MAX_FIRST_MATCH_MIN_SCORE 10000
+
+// The default and maximal numbers of visual words probed by each descriptor of a request.
+#define DEFAULT_NB_PROBES 1
+#define MAX_NB_PROBES 8
+
+
 struct SearchRequest
 {
+    SearchRequest()
+        : imageId(0), client(NULL), i_nbRerankedImages(DEFAULT_NB_RERANKED_IMAGES),
+          b_adaptiveDepth(false), i_maxNbResults(DEFAULT_NB_RESULTS),
+          b_geometricVerification(true),
+          b_firstMatch(false), i_firstMatchMinScore(DEFAULT_FIRST_MATCH_MIN_SCORE),
+          i_nbProbes(DEFAULT_NB_PROBES)
+    { }
+
     u_int32_t imageId;
     vector<char> imageData;
     ClientConnection *client;
+
+    // The parameters of the search.
+    unsigned i_nbRerankedImages; // The maximal number of reranked images.
+    /* If set, the reranking stops before i_nbRerankedImages images once the
+     * tf-idf scores have dropped. */
+    bool b_adaptiveDepth;
+    unsigned i_maxNbResults;
+    /* If not set, the images are not reranked and the results are the first
+     * images of the tf-idf ranking. */
+    bool b_geometricVerification;
+    /* If set, the images are verified in their ranking order and the search
+     * returns the first one whose score reaches i_firstMatchMinScore. */
+    bool b_firstMatch;
+    unsigned i_firstMatchMinScore;
+    /* The number of nearest visual words of each descriptor of a searched
+     * image, weighted by their distance to the descriptor. */
+    unsigned i_nbProbes;
+
     vector<u_int32_t> results;
     vector<Rect> boundingRects;
     vector<float> scores;
@@ -0,0 +1,104 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#ifndef PASTEC_THREADPOOL_H
+#define PASTEC_THREADPOOL_H
+
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+
+#include <thread.h>
+
+using namespace std;
+
+
+/**
+ * @brief A unit of work run by the threads of a pool.
+ * The tasks are owned by the code that submits them.
+ */
+class PoolTask
+{
+public:
+    virtual ~PoolTask() {}
+    virtual void run() = 0;
+};
+
+
+/**
+ * @brief A set of tasks whose end can be waited for.
+ */
+class TaskGroup
+{
+public:
+    TaskGroup();
+    ~TaskGroup();
+    void wait();
+
+private:
+    friend class ThreadPool;
+    friend class PoolWorkerThread;
+
+    void addTask();
+    void endTask();
+
+    unsigned i_nbPendingTasks;
+    pthread_mutex_t mutex;
+    pthread_cond_t doneCond;
+};
+
+
+class PoolWorkerThread;
+
+/**
+ * @brief A set of threads shared by the whole process that run the
+ * submitted tasks in their order of submission.
+ * The tasks must not wait for other tasks of the pool.
+ */
+class ThreadPool
+{
+public:
+    ThreadPool(unsigned i_nbThreads);
+    ~ThreadPool();
+    void submit(PoolTask *task, TaskGroup &group);
+    unsigned getNbThreads() const;
+
+private:
+    friend class PoolWorkerThread;
+
+    struct QueuedTask
+    {
+        PoolTask *task;
+        TaskGroup *group;
+    };
+
+    bool getNextTask(QueuedTask &queuedTask);
+
+    vector<PoolWorkerThread *> threads;
+    deque<QueuedTask> tasks;
+    bool b_stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t taskCond;
+};
+
+#endif // PASTEC_THREADPOOL_H
@@ -0,0 +1,120 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#ifndef PASTEC_WORKSTEALINGQUEUES_H
+#define PASTEC_WORKSTEALINGQUEUES_H
+
+#include <pthread.h>
+
+#include <deque>
+
+using namespace std;
+
+
+/**
+ * @brief A set of work queues, one per worker.
+ * Each worker takes the items of its own queue from the front. Once it is
+ * empty, the worker steals the items of the other queues from the back so
+ * that no worker stays idle while another one still has items to process.
+ */
+template <class T>
+class WorkStealingQueues
+{
+public:
+    WorkStealingQueues(unsigned i_nbQueues)
+        : i_nbQueues(i_nbQueues), queues(new Queue[i_nbQueues]) { }
+
+    ~WorkStealingQueues()
+    {
+        delete[] queues;
+    }
+
+    /**
+     * @brief Add an item to a queue.
+     * The items must all be pushed before the workers start.
+     * @param i_queue the queue.
+     * @param item the item.
+     */
+    void push(unsigned i_queue, const T &item)
+    {
+        queues[i_queue].items.push_back(item);
+    }
+
+    /**
+     * @brief Get the next item of a worker.
+     * @param i_queue the queue of the worker.
+     * @param item the item.
+     * @return false if all the queues are empty.
+     */
+    bool pop(unsigned i_queue, T &item)
+    {
+        if (popFront(queues[i_queue], item))
+            return true;
+
+        for (unsigned i = 1; i < i_nbQueues; ++i)
+            if (popBack(queues[(i_queue + i) % i_nbQueues], item))
+                return true;
+
+        return false;
+    }
+
+private:
+    struct Queue
+    {
+        Queue() { pthread_mutex_init(&mutex, NULL); }
+        ~Queue() { pthread_mutex_destroy(&mutex); }
+
+        deque<T> items;
+        pthread_mutex_t mutex;
+    };
+
+    static bool popFront(Queue &queue, T &item)
+    {
+        pthread_mutex_lock(&queue.mutex);
+        const bool b_found = !queue.items.empty();
+        if (b_found)
+        {
+            item = queue.items.front();
+            queue.items.pop_front();
+        }
+        pthread_mutex_unlock(&queue.mutex);
+        return b_found;
+    }
+
+    static bool popBack(Queue &queue, T &item)
+    {
+        pthread_mutex_lock(&queue.mutex);
+        const bool b_found = !queue.items.empty();
+        if (b_found)
+        {
+            item = queue.items.back();
+            queue.items.pop_back();
+        }
+        pthread_mutex_unlock(&queue.mutex);
+        return b_found;
+    }
+
+    unsigned i_nbQueues;
+    Queue *queues;
+};
+
+#endif // PASTEC_WORKSTEALINGQUEUES_H
@@ -203,6 +203,8 @@ int HTTPServer::answerToConnection(void *cls, MHD_Connection *connection,
 
         MHD_get_connection_values(connection, MHD_HEADER_KIND,
                                   &readAuthHeader, conInfo);
+        MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND,
+                                  &readArgument, conInfo);
 
         return MHD_YES;
     }
@@ -231,6 +233,19 @@ int HTTPServer::answerToConnection(void *cls, MHD_Connection *connection,
 }
 
 
+int HTTPServer::readArgument(void *cls, enum MHD_ValueKind kind,
+                             const char *key, const char *value)
+{
+    (void) kind;
+    ConnectionInfo *conInfo = (ConnectionInfo *)cls;
+
+    // The arguments without value are stored with an empty one.
+    conInfo->arguments[string(key)] = value != NULL ? string(value) : string();
+
+    return MHD_YES;
+}
+
+
 int HTTPServer::readAuthHeader(void *cls, enum MHD_ValueKind kind,
                                const char *key, const char *value)
 {
@@ -33,120 +33,557 @@
 #include <imagereranker.h>
 
 
-void *RANSACThread::run()
+void RerankingTask::run()
 {
-    for (unsigned i = 0; i < imageIds.size(); ++i)
+    RerankingCandidate candidate;
+    while (!b_matchFound && candidates.pop(i_queue, candidate))
     {
-        const unsigned i_imageId = imageIds[i];
-        const Histogram histogram = histograms[i];
-        unsigned i_binMax = max_element(histogram.bins, histogram.bins + HISTOGRAM_NB_BINS) - histogram.bins;
-        float i_maxVal = histogram.bins[i_binMax];
-        if (i_maxVal > 10)
+        RANSACTask &task = *candidate.task;
+        assert(task.points1.size() == task.points2.size());
+
+        // The decisive images are only verified to be checked.
+        bool b_verified = candidate.b_decisive;
+        if (!candidate.b_decisive || checkVerification)
         {
-            RANSACTask &task = imgTasks[i_imageId];
-            assert(task.points1.size() == task.points2.size());
+            double M[6];
+            b_verified = poseVoting
+                ? verifier.verifyPose(task.points2, task.points1, task.rotations, M)
+                : verifier.verify(task.points2, task.points1, task.qualities, M);
+        }
 
-            if (task.points1.size() >= RANSAC_MIN_INLINERS)
-            {
-                Mat H = pastecEstimateRigidTransform(task.points2, task.points1, true);
+        if (checkVerification)
+        {
+            Mat H = pastecEstimateRigidTransform(task.points2, task.points1, true);
+            if (b_verified != (countNonZero(H) != 0))
+                i_nbCheckErrors++;
+            if (candidate.b_decisive && !b_verified)
+                i_nbDecisiveErrors++;
+            b_verified |= candidate.b_decisive;
+        }
 
-                if (countNonZero(H) == 0)
-                    continue;
+        if (!b_verified)
+            continue;
 
-                Rect bRect1 = boundingRect(task.points1);
+        Rect bRect1 = boundingRect(task.points1);
 
-                pthread_mutex_lock(&mutex);
-                rankedResultsOut.push(SearchResult(i_maxVal, i_imageId, bRect1));
-                pthread_mutex_unlock(&mutex);
-            }
-        }
+        pthread_mutex_lock(&mutex);
+        rankedResultsOut.push(SearchResult(candidate.f_weight, candidate.i_imageId, bRect1));
+        pthread_mutex_unlock(&mutex);
+
+        if (i_firstMatchMinScore != 0 && candidate.f_weight >= i_firstMatchMinScore)
+            b_matchFound = true;
     }
 }
 
 
-void ImageReranker::rerank(unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
-                           unordered_map<u_int32_t, vector<Hit> > &indexHits,
-                           priority_queue<SearchResult> &rankedResultsIn,
-                           priority_queue<SearchResult> &rankedResultsOut,
-                           unsigned i_nbResults)
+/**
+ * @brief Compare two candidates according to their number of correspondences.
+ */
+static bool compareCandidateCosts(const RerankingCandidate &a, const RerankingCandidate &b)
+{
+    return a.task->points1.size() > b.task->points1.size();
+}
+
+
+/**
+ * @brief Predicate of the candidates that can be a first match.
+ */
+class ReachesScore
+{
+public:
+    ReachesScore(unsigned i_minScore) : i_minScore(i_minScore) { }
+
+    bool operator()(const RerankingCandidate &candidate) const
+    {
+        return candidate.f_weight >= i_minScore;
+    }
+
+private:
+    unsigned i_minScore;
+};
+
+
+/**
+ * @brief Make the table hold the images to rerank with empty histograms
+ * and correspondences.
+ * @param rankedResults the images to rerank.
+ */
+void RerankingTable::reset(const vector<SearchResult> &rankedResults)
+{
+    const unsigned i_nbCandidates = rankedResults.size();
+
+    unsigned i_nbEntries = 4;
+    i_shift = 30;
+    while (i_nbEntries < 4 * i_nbCandidates)
+    {
+        i_nbEntries <<= 1;
+        i_shift--;
+    }
+    i_mask = i_nbEntries - 1;
+
+    Entry emptyEntry;
+    emptyEntry.i_imageId = RERANKING_TABLE_EMPTY;
+    emptyEntry.i_rank = RERANKING_TABLE_EMPTY;
+    entries.assign(i_nbEntries, emptyEntry);
+
+    imageIds.resize(i_nbCandidates);
+    correspondences.clear();
+    if (histograms.size() < i_nbCandidates)
+    {
+        histograms.resize(i_nbCandidates);
+        tasks.resize(i_nbCandidates);
+    }
+
+    for (u_int32_t i_rank = 0; i_rank < i_nbCandidates; ++i_rank)
+    {
+        const u_int32_t i_imageId = rankedResults[i_rank].i_imageId;
+        imageIds[i_rank] = i_imageId;
+        histograms[i_rank] = Histogram();
+        tasks[i_rank].points1.clear();
+        tasks[i_rank].points2.clear();
+        tasks[i_rank].qualities.clear();
+        tasks[i_rank].rotations.clear();
+
+        u_int32_t i_entry = hash(i_imageId);
+        while (entries[i_entry].i_rank != RERANKING_TABLE_EMPTY)
+            i_entry = (i_entry + 1) & i_mask;
+        entries[i_entry].i_imageId = i_imageId;
+        entries[i_entry].i_rank = i_rank;
+    }
+}
+
+
+ImageReranker::ImageReranker(ThreadPool *threadPool, bool checkVerification,
+                             bool prosacSampling, bool adaptiveRansac, bool poseVoting)
+    : threadPool(threadPool), checkVerification(checkVerification),
+      prosacSampling(prosacSampling), adaptiveRansac(adaptiveRansac), poseVoting(poseVoting)
 {
-    unordered_set<u_int32_t> firstImageIds;
+    pthread_mutex_init(&tablesMutex, NULL);
+}
 
-    // Extract the first i_nbResults ranked images.
-    getFirstImageIds(rankedResultsIn, i_nbResults, firstImageIds);
 
-    unordered_map<u_int32_t, RANSACTask> imgTasks;
+ImageReranker::~ImageReranker()
+{
+    for (unsigned i = 0; i < freeTables.size(); ++i)
+        delete freeTables[i];
+    pthread_mutex_destroy(&tablesMutex);
+}
+
 
-    // Compute the histograms.
-    unordered_map<u_int32_t, Histogram> histograms; // key: the image id, value: the corresponding histogram.
+/**
+ * @brief Get a reranking table from the ones of the previous requests.
+ * @return the table.
+ */
+RerankingTable *ImageReranker::acquireTable()
+{
+    RerankingTable *table = NULL;
+    pthread_mutex_lock(&tablesMutex);
+    if (!freeTables.empty())
+    {
+        table = freeTables.back();
+        freeTables.pop_back();
+    }
+    pthread_mutex_unlock(&tablesMutex);
 
+    return table != NULL ? table : new RerankingTable();
+}
+
+
+/**
+ * @brief Give back a reranking table for the next requests.
+ * @param table the table.
+ */
+void ImageReranker::releaseTable(RerankingTable *table)
+{
+    pthread_mutex_lock(&tablesMutex);
+    freeTables.push_back(table);
+    pthread_mutex_unlock(&tablesMutex);
+}
+
+
+/**
+ * @brief Add a correspondence between a hit of the request and a hit of a
+ * candidate image to the histogram and the correspondences of the image.
+ * @param table the reranking table.
+ * @param i_rank the rank of the image.
+ * @param i_requestHit the position of the hit in the request hits.
+ * @param i_requestAngle the angle of the hit of the request.
+ * @param i_angle the angle of the hit of the image.
+ * @param x the abscissa of the hit of the image.
+ * @param y the ordinate of the hit of the image.
+ */
+void ImageReranker::addCorrespondence(RerankingTable &table, u_int32_t i_rank, u_int32_t i_requestHit,
+                                      u_int16_t i_requestAngle, u_int16_t i_angle, u_int16_t x, u_int16_t y)
+{
+    Histogram &histogram = table.getHistogram(i_rank);
+    histogram.bins[getHistogramBin(i_requestAngle, i_angle)]++;
+    histogram.i_total++;
+
+    Correspondence correspondence;
+    correspondence.i_rank = i_rank;
+    correspondence.i_requestHit = i_requestHit;
+    correspondence.i_angle = i_angle;
+    correspondence.x = x;
+    correspondence.y = y;
+    table.correspondences.push_back(correspondence);
+}
+
+
+/**
+ * @brief Return the quality of the correspondences of a word of the request.
+ * @param wordQualities the qualities of the words of the request.
+ * @param i_wordId the word.
+ * @return the quality or 0 if it is not known.
+ */
+float ImageReranker::getWordQuality(const unordered_map<u_int32_t, float> &wordQualities,
+                                    u_int32_t i_wordId)
+{
+    unordered_map<u_int32_t, float>::const_iterator it = wordQualities.find(i_wordId);
+    return it != wordQualities.end() ? it->second : 0;
+}
+
+
+/**
+ * @brief Store the hits of the request sorted by word id in the table with
+ * their quality for the PROSAC sampling.
+ * @param table the reranking table.
+ * @param imagesReqHits the hits of the request.
+ * @param wordQualities the qualities of the words of the request.
+ */
+void ImageReranker::setRequestHits(RerankingTable &table,
+                                   unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
+                                   const unordered_map<u_int32_t, float> &wordQualities)
+{
+    ForwardHits &requestHits = table.requestHits;
+    requestHits.clear();
     for (unordered_map<u_int32_t, list<Hit> >::const_iterator it = imagesReqHits.begin();
          it != imagesReqHits.end(); ++it)
     {
-        // Try to match all the visual words of the request image.
-        const unsigned i_wordId = it->first;
-        const list<Hit> &hits = it->second;
+        assert(it->second.size() == 1);
+        ForwardHit requestHit;
+        requestHit.i_wordId = it->first;
+        requestHit.i_angle = it->second.front().i_angle;
+        requestHit.x = it->second.front().x;
+        requestHit.y = it->second.front().y;
+        requestHits.push_back(requestHit);
+    }
+    sort(requestHits.begin(), requestHits.end());
+
+    vector<float> &requestQualities = table.requestQualities;
+    requestQualities.clear();
+    if (prosacSampling)
+        for (unsigned i = 0; i < requestHits.size(); ++i)
+            requestQualities.push_back(getWordQuality(wordQualities, requestHits[i].i_wordId));
+}
 
-        assert(hits.size() == 1);
 
-        // If there is several hits for the same word in the image...
-        const u_int16_t i_angle1 = hits.front().i_angle;
-        const Point2f point1(hits.front().x, hits.front().y);
-        const vector<Hit> &hitIndex = indexHits[i_wordId];
+/**
+ * @brief Gather the correspondences of the candidate images by scanning the
+ * posting lists of the words of the request.
+ * @param table the reranking table.
+ * @param indexHits the hits of the words of the request.
+ */
+void ImageReranker::gatherFromPostings(RerankingTable &table,
+                                       unordered_map<u_int32_t, WordHits> &indexHits)
+{
+    const ForwardHits &requestHits = table.requestHits;
+    vector<u_int32_t> &imageIds = table.decodedImageIds;
+
+    for (u_int32_t i_requestHit = 0; i_requestHit < requestHits.size(); ++i_requestHit)
+    {
+        // Try to match all the visual words of the request image.
+        const ForwardHit &requestHit = requestHits[i_requestHit];
+        const WordHits &wordHits = indexHits[requestHit.i_wordId];
 
-        for (unsigned i = 0; i < hitIndex.size(); ++i)
+        if (!wordHits.packedBase.empty())
         {
-            const u_int32_t i_imageId = hitIndex[i].i_imageId;
-            // Test if the image belongs to the image to rerank.
-            if (firstImageIds.find(i_imageId) != firstImageIds.end())
+            // Only the payloads of the candidate images are read.
+            const PackedHitSpan &packedHits = wordHits.packedBase;
+            imageIds.resize(packedHits.size());
+            packedHits.decodeImageIds(imageIds.data());
+            for (unsigned i = 0; i < imageIds.size(); ++i)
             {
-                const u_int16_t i_angle2 = hitIndex[i].i_angle;
-                float f_diff = angleDiff(i_angle1, i_angle2);
-                unsigned bin = (f_diff - DIFF_MIN) / 360 * HISTOGRAM_NB_BINS;
-                assert(bin < HISTOGRAM_NB_BINS);
+                const u_int32_t i_rank = table.getRank(imageIds[i]);
+                if (i_rank != RERANKING_TABLE_EMPTY)
+                    addCorrespondence(table, i_rank, i_requestHit, requestHit.i_angle,
+                                      packedHits.p_payloads[i].i_angle,
+                                      packedHits.p_payloads[i].x, packedHits.p_payloads[i].y);
+            }
+        }
+        for (unsigned j = 0; j < NB_HIT_SEGMENTS; ++j)
+        {
+            const HitSpan &hitIndex = wordHits.segments[j];
+            for (const Hit *it = hitIndex.begin(); it != hitIndex.end(); ++it)
+            {
+                // Test if the image belongs to the image to rerank.
+                const u_int32_t i_rank = table.getRank(it->i_imageId);
+                if (i_rank != RERANKING_TABLE_EMPTY)
+                    addCorrespondence(table, i_rank, i_requestHit, requestHit.i_angle,
+                                      it->i_angle, it->x, it->y);
+            }
+        }
+    }
+}
 
-                Histogram &histogram = histograms[i_imageId];
-                histogram.bins[bin]++;
-                histogram.i_total++;
 
-                const Point2f point2(hitIndex[i].x, hitIndex[i].y);
-                RANSACTask &imgTask = imgTasks[i_imageId];
+/**
+ * @brief Gather the correspondences of the candidate images from their
+ * forward hits. The hits of each image and the ones of the request are
+ * sorted by word id and intersected so that only the hits of the candidates
+ * are read.
+ * @param table the reranking table.
+ * @param forwardHits the forward hits of the candidates, in the rank order.
+ * @param i_begin the rank of the first candidate to gather.
+ * @param i_end the rank following the last candidate to gather.
+ */
+void ImageReranker::gatherFromForwardHits(RerankingTable &table,
+                                          const vector<shared_ptr<const ForwardHits> > &forwardHits,
+                                          u_int32_t i_begin, u_int32_t i_end)
+{
+    const ForwardHits &requestHits = table.requestHits;
 
-                imgTask.points1.push_back(point1);
-                imgTask.points2.push_back(point2);
-            }
+    for (u_int32_t i_rank = i_begin; i_rank < i_end; ++i_rank)
+    {
+        if (!forwardHits[i_rank])
+            continue; // The image was removed.
+
+        const ForwardHits &imageHits = *forwardHits[i_rank];
+        ForwardHits::const_iterator reqIt = requestHits.begin();
+        for (ForwardHits::const_iterator it = imageHits.begin();
+             it != imageHits.end() && reqIt != requestHits.end(); ++it)
+        {
+            while (reqIt != requestHits.end() && reqIt->i_wordId < it->i_wordId)
+                ++reqIt;
+            if (reqIt != requestHits.end() && reqIt->i_wordId == it->i_wordId)
+                addCorrespondence(table, i_rank, reqIt - requestHits.begin(), reqIt->i_angle,
+                                  it->i_angle, it->x, it->y);
         }
     }
+}
 
-    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    #define NB_RANSAC_THREAD 4
-    RANSACThread *threads[NB_RANSAC_THREAD];
+/**
+ * @brief Find the peak of the histogram of each candidate. The candidates
+ * whose peak holds HISTOGRAM_MIN_PEAK correspondences or less are not verified.
+ * @param table the reranking table.
+ * @param i_begin the rank of the first candidate.
+ * @param i_end the rank following the last candidate.
+ */
+void ImageReranker::selectPeaks(RerankingTable &table, u_int32_t i_begin, u_int32_t i_end)
+{
+    table.peakBins.resize(table.getNbCandidates());
+    for (u_int32_t i_rank = i_begin; i_rank < i_end; ++i_rank)
+    {
+        const Histogram &histogram = table.getHistogram(i_rank);
+        const unsigned i_binMax = max_element(histogram.bins, histogram.bins + HISTOGRAM_NB_BINS)
+                                  - histogram.bins;
+        table.peakBins[i_rank] = histogram.bins[i_binMax] > HISTOGRAM_MIN_PEAK
+                                 ? i_binMax : RERANKING_NO_PEAK;
+    }
+}
+
+
+/**
+ * @brief Build the points of the verification of the candidates that have
+ * a histogram peak from their correspondences of the dominant bins.
+ * @param table the reranking table.
+ */
+void ImageReranker::buildPoints(RerankingTable &table)
+{
+    const ForwardHits &requestHits = table.requestHits;
+    const vector<Correspondence> &correspondences = table.correspondences;
+
+    for (unsigned i = 0; i < correspondences.size(); ++i)
+    {
+        const Correspondence &correspondence = correspondences[i];
+        const unsigned i_peakBin = table.peakBins[correspondence.i_rank];
+        if (i_peakBin == RERANKING_NO_PEAK)
+            continue;
+
+        const ForwardHit &requestHit = requestHits[correspondence.i_requestHit];
+        const unsigned i_bin = getHistogramBin(requestHit.i_angle, correspondence.i_angle);
+        const unsigned i_binDist = (i_bin - i_peakBin + HISTOGRAM_NB_BINS) % HISTOGRAM_NB_BINS;
+        if (i_binDist > HISTOGRAM_PEAK_HALF_WIDTH
+            && i_binDist < HISTOGRAM_NB_BINS - HISTOGRAM_PEAK_HALF_WIDTH)
+            continue;
+
+        RANSACTask &imgTask = table.getTask(correspondence.i_rank);
+        imgTask.points1.push_back(Point2f(requestHit.x, requestHit.y));
+        imgTask.points2.push_back(Point2f(correspondence.x, correspondence.y));
+        if (prosacSampling)
+            imgTask.qualities.push_back(table.requestQualities[correspondence.i_requestHit]);
+        if (poseVoting)
+            imgTask.rotations.push_back((u_int16_t)(requestHit.i_angle - correspondence.i_angle)
+                                        * 360.0f / (1 << 16));
+    }
+}
+
+
+/**
+ * @brief Verify the geometry of the candidates of a range of ranks that
+ * have a histogram peak. Their points must have been built.
+ * @param table the reranking table.
+ * @param i_begin the first rank.
+ * @param i_end the rank following the last one.
+ * @param i_firstMatchMinScore if not 0, the images are verified in their
+ * ranking order, the ones whose score reaches this threshold first, and
+ * the verification stops once one of them is verified.
+ * @param rankedResultsOut the verified images.
+ * @param counts the counts of the verification, incremented.
+ * @return true if the verification was stopped by a first match.
+ */
+bool ImageReranker::verifyCandidates(RerankingTable &table, u_int32_t i_begin, u_int32_t i_end,
+                                     unsigned i_firstMatchMinScore,
+                                     priority_queue<SearchResult> &rankedResultsOut,
+                                     VerificationCounts &counts)
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    for (unsigned i = 0; i < NB_RANSAC_THREAD; ++i)
-        threads[i] = new RANSACThread(mutex, imgTasks, rankedResultsOut);
+    // Select the images whose histogram has a clear peak.
+    vector<RerankingCandidate> candidateList;
+    for (u_int32_t i_rank = i_begin; i_rank < i_end; ++i_rank)
+    {
+        const unsigned i_peakBin = table.peakBins[i_rank];
+        if (i_peakBin == RERANKING_NO_PEAK)
+            continue;
+
+        const Histogram &histogram = table.getHistogram(i_rank);
+        RerankingCandidate candidate;
+        candidate.i_imageId = table.getImageId(i_rank);
+        candidate.f_weight = histogram.bins[i_peakBin];
+        candidate.task = &table.getTask(i_rank);
+
+        const unsigned i_nbPoints = candidate.task->points1.size();
+        candidate.b_decisive = i_nbPoints >= HISTOGRAM_DECISIVE_MIN_NB
+            && i_nbPoints >= HISTOGRAM_DECISIVE_RATIO * histogram.i_total;
+        counts.i_nbDecisiveImages += candidate.b_decisive;
+        if (i_nbPoints >= RANSAC_MIN_INLINERS)
+            candidateList.push_back(candidate);
+    }
+    counts.i_nbImages += candidateList.size();
 
-    // Rank the images according to their histogram.
-    unsigned i = 0;
-    for (unordered_map<unsigned, Histogram>::iterator it = histograms.begin();
-         it != histograms.end(); ++it, ++i)
+    WorkStealingQueues<RerankingCandidate> candidates(NB_RANSAC_TASKS);
+    if (i_firstMatchMinScore == 0)
     {
-        unsigned i_imageId = it->first;
-        Histogram histogram = it->second;
-        threads[i % NB_RANSAC_THREAD]->imageIds.push_back(i_imageId);
-        threads[i % NB_RANSAC_THREAD]->histograms.push_back(histogram);
+        /* The cost of the verification of an image grows with its number of
+         * correspondences. The most expensive images are verified first and
+         * the idle tasks steal the remaining images of the others. */
+        sort(candidateList.begin(), candidateList.end(), compareCandidateCosts);
+        for (unsigned i = 0; i < candidateList.size(); ++i)
+            candidates.push(i % NB_RANSAC_TASKS, candidateList[i]);
     }
+    else
+    {
+        /* All the tasks take the images from a single queue in their ranking
+         * order, the ones that can be a first match first, so that the most
+         * likely match is verified as early as possible. */
+        stable_partition(candidateList.begin(), candidateList.end(),
+                         ReachesScore(i_firstMatchMinScore));
+        for (unsigned i = 0; i < candidateList.size(); ++i)
+            candidates.push(0, candidateList[i]);
+    }
+
+    atomic<bool> b_matchFound(false);
+    RerankingTask *tasks[NB_RANSAC_TASKS];
+    for (unsigned i = 0; i < NB_RANSAC_TASKS; ++i)
+        tasks[i] = new RerankingTask(mutex, candidates, i_firstMatchMinScore == 0 ? i : 0,
+                                     rankedResultsOut, checkVerification, prosacSampling,
+                                     adaptiveRansac, poseVoting, i_firstMatchMinScore,
+                                     b_matchFound);
 
     // Compute
-    for (unsigned i = 0; i < NB_RANSAC_THREAD; ++i)
-        threads[i]->start();
-    for (unsigned i = 0; i < NB_RANSAC_THREAD; ++i)
+    TaskGroup rerankingTasks;
+    for (unsigned i = 0; i < NB_RANSAC_TASKS; ++i)
+        threadPool->submit(tasks[i], rerankingTasks);
+    rerankingTasks.wait();
+
+    for (unsigned i = 0; i < NB_RANSAC_TASKS; ++i)
     {
-        threads[i]->join();
-        delete threads[i];
+        counts.i_nbCheckErrors += tasks[i]->i_nbCheckErrors;
+        counts.i_nbDecisiveErrors += tasks[i]->i_nbDecisiveErrors;
+        delete tasks[i];
     }
 
     pthread_mutex_destroy(&mutex);
+
+    return b_matchFound;
+}
+
+
+/**
+ * @brief Verify the geometry of the first ranked images.
+ * The verification is staged so that its cost grows with the number of
+ * plausible matches: the rotation histograms of the candidates are built
+ * from compact correspondences, the points are only built for the
+ * candidates with a clear histogram peak from the correspondences of its
+ * dominant bins and the RANSAC is skipped when these bins hold most of
+ * the correspondences.
+ * In the first match mode, the candidates are processed by batches of
+ * growing size in their ranking order if their forward hits are known so
+ * that the correspondences of the images that follow the match are not
+ * even gathered.
+ * @param imagesReqHits the hits of the request.
+ * @param indexHits the hits of the words of the request.
+ * @param rankedResultsIn the images to rerank.
+ * @param forwardHits the forward hits of the images to rerank in the same
+ * order or an empty vector to read their hits from the posting lists.
+ * @param wordQualities the qualities of the words of the request for the
+ * PROSAC sampling.
+ * @param i_firstMatchMinScore if not 0, the reranking stops at the first
+ * verified image whose score reaches this threshold.
+ * @param rankedResultsOut the verified images.
+ */
+void ImageReranker::rerank(unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
+                           unordered_map<u_int32_t, WordHits> &indexHits,
+                           const vector<SearchResult> &rankedResultsIn,
+                           const vector<shared_ptr<const ForwardHits> > &forwardHits,
+                           const unordered_map<u_int32_t, float> &wordQualities,
+                           unsigned i_firstMatchMinScore,
+                           priority_queue<SearchResult> &rankedResultsOut)
+{
+    // The ranked images are already limited to the ones to rerank.
+    RerankingTable *table = acquireTable();
+    table->reset(rankedResultsIn);
+    setRequestHits(*table, imagesReqHits, wordQualities);
+
+    const u_int32_t i_nbCandidates = table->getNbCandidates();
+    VerificationCounts counts;
+    if (i_firstMatchMinScore == 0 || forwardHits.empty())
+    {
+        if (forwardHits.empty())
+            gatherFromPostings(*table, indexHits);
+        else
+            gatherFromForwardHits(*table, forwardHits, 0, i_nbCandidates);
+
+        selectPeaks(*table, 0, i_nbCandidates);
+        buildPoints(*table);
+        verifyCandidates(*table, 0, i_nbCandidates, i_firstMatchMinScore,
+                         rankedResultsOut, counts);
+    }
+    else
+    {
+        bool b_matchFound = false;
+        unsigned i_batchSize = FIRST_MATCH_FIRST_BATCH_SIZE;
+        for (u_int32_t i_begin = 0; i_begin < i_nbCandidates && !b_matchFound;
+             i_batchSize *= 2)
+        {
+            const u_int32_t i_end = min(i_nbCandidates, i_begin + i_batchSize);
+            table->correspondences.clear();
+            gatherFromForwardHits(*table, forwardHits, i_begin, i_end);
+            selectPeaks(*table, i_begin, i_end);
+            buildPoints(*table);
+            b_matchFound = verifyCandidates(*table, i_begin, i_end, i_firstMatchMinScore,
+                                            rankedResultsOut, counts);
+            i_begin = i_end;
+        }
+    }
+
+    if (checkVerification)
+        cout << "Verification check: " << counts.i_nbCheckErrors << " of the "
+             << counts.i_nbImages << " images differ, " << counts.i_nbDecisiveErrors
+             << " of the " << counts.i_nbDecisiveImages << " decisive images are rejected." << endl;
+
+    releaseTable(table);
 }
 
 
@@ -164,47 +601,3 @@ public:
 private:
     int x, y;
 };
-
-
-/**
- * @brief Return the first ids of ranked images.
- * @param rankedResultsIn the ranked images.
- * @param i_nbResults the number of images to return.
- * @param firstImageIds a set to return the image ids.
- */
-void ImageReranker::getFirstImageIds(priority_queue<SearchResult> &rankedResultsIn,
-                                     unsigned i_nbResults, unordered_set<u_int32_t> &firstImageIds)
-{
-    unsigned i_res = 0;
-    while(!rankedResultsIn.empty()
-          && i_res < i_nbResults)
-    {
-        const SearchResult &res = rankedResultsIn.top();
-        firstImageIds.insert(res.i_imageId);
-        rankedResultsIn.pop();
-        i_res++;
-    }
-}
-
-
-float ImageReranker::angleDiff(unsigned i_angle1, unsigned i_angle2)
-{
-    // Convert the angle in the [-180, 180] range.
-    float i1 = (float)i_angle1 * 360 / (1 << 16);
-    float i2 = (float)i_angle2 * 360 / (1 << 16);
-
-    i1 = i1 <= 180 ? i1 : i1 - 360;
-    i2 = i2 <= 180 ? i2 : i2 - 360;
-
-    // Compute the difference between the two angles.
-    float diff = i1 - i2;
-    if (diff < DIFF_MIN)
-        diff += 360;
-    else if (diff >= 360 + DIFF_MIN)
-        diff -= 360;
-
-    assert(diff >= DIFF_MIN);
-    assert(diff < 360 + DIFF_MIN);
-
-    return diff;
-}
@@ -49,7 +49,7 @@
 #include <imagereranker.h>
 
 
-void RANSACThread::getRTMatrix(const Point2f* a, const Point2f* b,
+void RerankingTask::getRTMatrix(const Point2f* a, const Point2f* b,
                                int count, Mat& M, bool fullAffine)
 {
     CV_Assert( M.isContinuous() );
@@ -133,7 +133,7 @@ void RANSACThread::getRTMatrix(const Point2f* a, const Point2f* b,
 }
 
 
-cv::Mat RANSACThread::pastecEstimateRigidTransform(InputArray src1, InputArray src2,
+cv::Mat RerankingTask::pastecEstimateRigidTransform(InputArray src1, InputArray src2,
                                                    bool fullAffine)
 {
     Mat M(2, 3, CV_64F), A = src1.getMat(), B = src2.getMat();
@@ -166,9 +166,13 @@ cv::Mat RANSACThread::pastecEstimateRigidTransform(InputArray src1, InputArray s
     if( count < RANSAC_SIZE0 )
         return Mat();
 
-    Rect bRect;
+    Rect bRect = boundingRect(src1);
     vector<cv::Point2f> bRectPoints(4);
     vector<cv::Point2f> bRectPointsProj(4);
+    bRectPoints[0] = Point2f(bRect.x, bRect.y);
+    bRectPoints[1] = Point2f(bRect.x + bRect.width, bRect.y);
+    bRectPoints[2] = Point2f(bRect.x + bRect.width, bRect.y + bRect.height);
+    bRectPoints[3] = Point2f(bRect.x, bRect.y + bRect.height);
 
     // RANSAC stuff:
     // 1. find the consensus
@@ -237,12 +241,6 @@ cv::Mat RANSACThread::pastecEstimateRigidTransform(InputArray src1, InputArray s
         // estimate the transformation using 3 points
         getRTMatrix( a, b, 3, M, fullAffine );
 
-        bRect = boundingRect(src1);
-        bRectPoints[0] = Point2f(bRect.x, bRect.y);
-        bRectPoints[1] = Point2f(bRect.x + bRect.width, bRect.y);
-        bRectPoints[2] = Point2f(bRect.x + bRect.width, bRect.y + bRect.height);
-        bRectPoints[3] = Point2f(bRect.x, bRect.y + bRect.height);
-
         transform(bRectPoints, bRectPointsProj, M);
 
         bool b_transformOk = true;
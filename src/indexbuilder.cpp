@@ -0,0 +1,260 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <stdint.h>
+#include <vector>
+
+#include <messages.h>
+#include <orb/orbfeatureextractor.h>
+#include <orb/orbindex.h>
+#include <orb/orbwordindex.h>
+
+
+using namespace std;
+
+// Number of images whose data are read and indexed at once.
+#define DEFAULT_BUILD_BATCH_SIZE 1000
+
+
+void printUsage()
+{
+    cout << "Usage :" << endl
+         << "./pastec-build [-i indexPath] [-t indexTagsPath] [--forward-index] [--threads nbThreads] [--batch-size nbImages] visualWordList manifest" << endl
+         << "Each line of the manifest is an image id, the path of the image file and an optional tag, separated by white spaces." << endl;
+}
+
+
+/**
+ * @brief Read the content of a file.
+ * @param path the file path.
+ * @param data the vector the content is copied to.
+ * @return true on success else false.
+ */
+bool readFile(string path, vector<char> &data)
+{
+    ifstream ifs(path.c_str(), ios_base::binary);
+    if (!ifs.good())
+        return false;
+
+    ifs.seekg(0, ios_base::end);
+    data.resize(ifs.tellg());
+    ifs.seekg(0, ios_base::beg);
+    ifs.read(data.data(), data.size());
+
+    return ifs.good();
+}
+
+
+/**
+ * @brief Index a batch of images.
+ * @param featureExtractor the feature extractor.
+ * @param index the index.
+ * @param imageIds the image ids.
+ * @param imagePaths the image file paths.
+ * @param imageTags the image tags.
+ * @return the number of images added.
+ */
+unsigned indexBatch(ORBFeatureExtractor *featureExtractor, ORBIndex *index,
+                    const vector<unsigned> &imageIds, const vector<string> &imagePaths,
+                    const vector<string> &imageTags)
+{
+    vector<unsigned> batchIds;
+    vector<string> batchTags;
+    vector<unsigned> imgSizes;
+    vector<char *> imgData;
+    vector<vector<char> > fileData(imageIds.size());
+
+    for (unsigned i = 0; i < imageIds.size(); ++i)
+    {
+        if (!readFile(imagePaths[i], fileData[i]) || fileData[i].empty())
+        {
+            cout << "Could not read the image file " << imagePaths[i] << "." << endl;
+            continue;
+        }
+        batchIds.push_back(imageIds[i]);
+        batchTags.push_back(imageTags[i]);
+        imgSizes.push_back(fileData[i].size());
+        imgData.push_back(fileData[i].data());
+    }
+
+    vector<u_int32_t> results;
+    vector<unsigned> nbFeaturesExtracted;
+    featureExtractor->processNewImages(batchIds, imgSizes, imgData,
+                                       results, nbFeaturesExtracted);
+
+    // Only the added images are tagged.
+    unsigned i_nbAdded = 0;
+    for (unsigned i = 0; i < batchIds.size(); ++i)
+    {
+        if (results[i] == IMAGE_ADDED)
+        {
+            i_nbAdded++;
+            if (!batchTags[i].empty())
+                index->addTag(batchIds[i], batchTags[i]);
+        }
+        else
+            cout << "Image " << batchIds[i] << " not added: "
+                 << Converter::codeToString(results[i]) << "." << endl;
+    }
+
+    return i_nbAdded;
+}
+
+
+int main(int argc, char** argv)
+{
+    cout << "Pastec Index Builder v0.0.1" << endl;
+
+#define EXIT_IF_LAST_ARGUMENTS(n) \
+    if (i >= argc - n)            \
+    {                             \
+        printUsage();             \
+        return 1;                 \
+    }
+
+    string visualWordPath;
+    string manifestPath;
+    string indexPath(DEFAULT_INDEX_PATH);
+    string indexTagsPath(DEFAULT_INDEX_TAGS_PATH);
+    bool buildForwardIndex = false;
+    unsigned i_batchSize = DEFAULT_BUILD_BATCH_SIZE;
+    unsigned i_nbThreads = 0;
+
+    int i = 1;
+    while (i < argc)
+    {
+        if (string(argv[i]) == "-i")
+        {
+            EXIT_IF_LAST_ARGUMENTS(3)
+            indexPath = argv[++i];
+        }
+        else if (string(argv[i]) == "-t")
+        {
+            EXIT_IF_LAST_ARGUMENTS(3)
+            indexTagsPath = argv[++i];
+        }
+        else if (string(argv[i]) == "--forward-index")
+        {
+            buildForwardIndex = true;
+        }
+        else if (string(argv[i]) == "--threads")
+        {
+            EXIT_IF_LAST_ARGUMENTS(3)
+            i_nbThreads = atoi(argv[++i]);
+        }
+        else if (string(argv[i]) == "--batch-size")
+        {
+            EXIT_IF_LAST_ARGUMENTS(3)
+            i_batchSize = max(atoi(argv[++i]), 1);
+        }
+        else if (i == argc - 2)
+        {
+            visualWordPath = argv[i];
+            manifestPath = argv[++i];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+        ++i;
+    }
+
+    if (manifestPath.empty())
+    {
+        printUsage();
+        return 1;
+    }
+
+    ifstream manifest(manifestPath.c_str());
+    if (!manifest.good())
+    {
+        cout << "Could not open the manifest " << manifestPath << "." << endl;
+        return 1;
+    }
+
+    // The index starts empty: nothing is loaded.
+    ORBIndex *index = new ORBIndex("", buildForwardIndex, false, 0, false, false);
+    index->setAutoMerge(false);
+    ORBWordIndex *wordIndex = new ORBWordIndex(visualWordPath);
+    ThreadPool *threadPool = new ThreadPool(i_nbThreads);
+    ORBFeatureExtractor *featureExtractor = new ORBFeatureExtractor(index, wordIndex, threadPool);
+
+    vector<unsigned> imageIds;
+    vector<string> imagePaths;
+    vector<string> imageTags;
+    unsigned i_nbImages = 0;
+    unsigned i_nbAdded = 0;
+    string line;
+    unsigned i_lineNumber = 0;
+    while (getline(manifest, line))
+    {
+        i_lineNumber++;
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue; // Empty line.
+        istringstream iss(line);
+        long i_imageId;
+        string imagePath;
+        // The ids that do not fit in 32 bits are rejected instead of truncated.
+        if (!(iss >> i_imageId) || i_imageId < 0 || i_imageId > UINT32_MAX
+            || !(iss >> imagePath))
+        {
+            cout << "Misformatted line " << i_lineNumber << " in the manifest." << endl;
+            continue;
+        }
+        string tag;
+        getline(iss >> ws, tag);
+
+        imageIds.push_back(i_imageId);
+        imagePaths.push_back(imagePath);
+        imageTags.push_back(tag);
+        i_nbImages++;
+
+        if (imageIds.size() == i_batchSize)
+        {
+            i_nbAdded += indexBatch(featureExtractor, index, imageIds, imagePaths, imageTags);
+            imageIds.clear();
+            imagePaths.clear();
+            imageTags.clear();
+        }
+    }
+    if (!imageIds.empty())
+        i_nbAdded += indexBatch(featureExtractor, index, imageIds, imagePaths, imageTags);
+
+    cout << i_nbAdded << " of the " << i_nbImages << " images of the manifest added." << endl;
+
+    int i_ret = 0;
+    if (index->write(indexPath) != INDEX_WRITTEN
+        || index->writeTags(indexTagsPath) != INDEX_TAGS_WRITTEN)
+        i_ret = 1;
+
+    delete featureExtractor;
+    delete threadPool;
+    delete wordIndex;
+    delete index;
+
+    return i_ret;
+}
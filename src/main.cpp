@@ -42,7 +42,8 @@ void intHandler(int signum) {
 void printUsage()
 {
     cout << "Usage :" << endl
-         << "./PastecIndex [-p portNumber] [-i indexPath] [--forward-index] [--https] [--auth-key AuthKey] visualWordList" << endl;
+         << "./PastecIndex [-p portNumber] [-i indexPath] [--forward-index] [--mmap] [--load-threads nbThreads] [--compress-ids] [--forward-hits] [--threads nbThreads] [--pruned-ranking] [--check-pruned-ranking] [--check-ransac] [--prosac] [--adaptive-ransac] [--pose-voting] [--https] [--auth-key AuthKey] visualWordList" << endl
+         << "With --mmap, the index file is read in place until the first merge of the added and removed images, which writes the merged hits to a new file next to it that is mapped in turn." << endl;
 }
 
 
@@ -67,6 +68,17 @@ int main(int argc, char** argv)
     string visualWordPath;
     string indexPath(DEFAULT_INDEX_PATH);
     bool buildForwardIndex = false;
+    bool mapIndexFile = false;
+    unsigned i_nbLoadingThreads = 0;
+    bool compressImageIds = false;
+    bool buildForwardHits = false;
+    unsigned i_nbThreads = 0;
+    bool prunedRanking = false;
+    bool checkPrunedRanking = false;
+    bool checkVerification = false;
+    bool prosacSampling = false;
+    bool adaptiveRansac = false;
+    bool poseVoting = false;
     string authKey("");
     bool https = false;
 
@@ -96,6 +108,53 @@ int main(int argc, char** argv)
         {
             buildForwardIndex = true;
         }
+        else if (string(argv[i]) == "--mmap")
+        {
+            mapIndexFile = true;
+        }
+        else if (string(argv[i]) == "--load-threads")
+        {
+            EXIT_IF_LAST_ARGUMENT()
+            i_nbLoadingThreads = atoi(argv[++i]);
+        }
+        else if (string(argv[i]) == "--compress-ids")
+        {
+            compressImageIds = true;
+        }
+        else if (string(argv[i]) == "--forward-hits")
+        {
+            buildForwardHits = true;
+        }
+        else if (string(argv[i]) == "--pruned-ranking")
+        {
+            prunedRanking = true;
+        }
+        else if (string(argv[i]) == "--check-pruned-ranking")
+        {
+            prunedRanking = true;
+            checkPrunedRanking = true;
+        }
+        else if (string(argv[i]) == "--check-ransac")
+        {
+            checkVerification = true;
+        }
+        else if (string(argv[i]) == "--prosac")
+        {
+            prosacSampling = true;
+        }
+        else if (string(argv[i]) == "--adaptive-ransac")
+        {
+            adaptiveRansac = true;
+        }
+        else if (string(argv[i]) == "--pose-voting")
+        {
+            poseVoting = true;
+        }
+        else if (string(argv[i]) == "--threads")
+        {
+            EXIT_IF_LAST_ARGUMENT()
+            i_nbThreads = atoi(argv[++i]);
+        }
         else if (i == argc - 1)
         {
             visualWordPath = argv[i];
@@ -108,10 +167,14 @@ int main(int argc, char** argv)
         ++i;
     }
 
-    Index *index = new ORBIndex(indexPath, buildForwardIndex);
+    Index *index = new ORBIndex(indexPath, buildForwardIndex, mapIndexFile,
+                                 i_nbLoadingThreads, compressImageIds, buildForwardHits);
     ORBWordIndex *wordIndex = new ORBWordIndex(visualWordPath);
-    FeatureExtractor *ife = new ORBFeatureExtractor((ORBIndex *)index, wordIndex);
-    Searcher *is = new ORBSearcher((ORBIndex *)index, wordIndex);
+    ThreadPool *threadPool = new ThreadPool(i_nbThreads);
+    FeatureExtractor *ife = new ORBFeatureExtractor((ORBIndex *)index, wordIndex, threadPool);
+    Searcher *is = new ORBSearcher((ORBIndex *)index, wordIndex, threadPool,
+                                   prunedRanking, checkPrunedRanking, checkVerification,
+                                   prosacSampling, adaptiveRansac, poseVoting);
     ImageDownloader *imgDownloader = new ImageDownloader();
 
     RequestHandler *rh = new RequestHandler(ife, is, index, imgDownloader, authKey);
@@ -128,6 +191,7 @@ int main(int argc, char** argv)
     delete imgDownloader;
     delete (ORBSearcher *)is;
     delete (ORBFeatureExtractor *)ife;
+    delete threadPool;
     delete (ORBIndex *)index;
 
     return 0;
@@ -0,0 +1,239 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <algorithm>
+
+#include <indexepoch.h>
+
+
+SlotTable::SlotTable()
+    : i_nbSlots(0)
+{
+    for (unsigned i = 0; i < NB_SLOT_CHUNKS; ++i)
+        chunks[i].store(NULL, memory_order_relaxed);
+    pthread_mutex_init(&freeSlotsMutex, NULL);
+}
+
+
+SlotTable::~SlotTable()
+{
+    for (unsigned i = 0; i < NB_SLOT_CHUNKS; ++i)
+        delete[] chunks[i].load(memory_order_relaxed);
+    pthread_mutex_destroy(&freeSlotsMutex);
+}
+
+
+/**
+ * @brief Get a slot for a new image.
+ * The released slots are reused first.
+ * @return the slot.
+ * Only one thread may call this function at a time.
+ */
+u_int32_t SlotTable::acquireSlot()
+{
+    pthread_mutex_lock(&freeSlotsMutex);
+    if (!freeSlots.empty())
+    {
+        const u_int32_t i_slot = freeSlots.back();
+        freeSlots.pop_back();
+        pthread_mutex_unlock(&freeSlotsMutex);
+        return i_slot;
+    }
+    pthread_mutex_unlock(&freeSlotsMutex);
+
+    const u_int32_t i_slot = i_nbSlots.load(memory_order_relaxed);
+    const u_int32_t i_chunk = i_slot >> SLOT_CHUNK_SHIFT;
+    if (chunks[i_chunk].load(memory_order_relaxed) == NULL)
+        chunks[i_chunk].store(new SlotInfo[SLOT_CHUNK_SIZE], memory_order_release);
+    i_nbSlots.store(i_slot + 1, memory_order_release);
+
+    return i_slot;
+}
+
+
+/**
+ * @brief Make slots available again for new images.
+ * @param slots the slots.
+ */
+void SlotTable::releaseSlots(const vector<u_int32_t> &slots)
+{
+    pthread_mutex_lock(&freeSlotsMutex);
+    freeSlots.insert(freeSlots.end(), slots.begin(), slots.end());
+    pthread_mutex_unlock(&freeSlotsMutex);
+}
+
+
+DeltaShard::DeltaShard()
+{
+    for (unsigned i = 0; i < INDEX_SHARD_SIZE; ++i)
+        words[i].store(NULL, memory_order_relaxed);
+    pthread_mutex_init(&mutex, NULL);
+}
+
+
+DeltaShard::~DeltaShard()
+{
+    for (unsigned i = 0; i < INDEX_SHARD_SIZE; ++i)
+        delete words[i].load(memory_order_relaxed);
+    pthread_mutex_destroy(&mutex);
+}
+
+
+/**
+ * @brief Append hits to the posting lists of their words.
+ * Each shard touched by the hits is locked in turn.
+ * @param wordHits the hits sorted by word id.
+ * @param retiredPostings the vector the replaced posting lists are appended to.
+ * They must not be freed while a reader can still use them.
+ */
+void DeltaSegment::append(const vector<WordHit> &wordHits,
+                          vector<DeltaPostings *> &retiredPostings)
+{
+    vector<WordHit>::const_iterator it = wordHits.begin();
+    while (it != wordHits.end())
+    {
+        const unsigned i_shard = it->i_wordId / INDEX_SHARD_SIZE;
+        DeltaShard &shard = shards[i_shard];
+
+        pthread_mutex_lock(&shard.mutex);
+        while (it != wordHits.end() && it->i_wordId / INDEX_SHARD_SIZE == i_shard)
+        {
+            vector<WordHit>::const_iterator wordEnd = it + 1;
+            while (wordEnd != wordHits.end() && wordEnd->i_wordId == it->i_wordId)
+                ++wordEnd;
+            appendToShard(shard, it->i_wordId % INDEX_SHARD_SIZE, it, wordEnd, retiredPostings);
+            it = wordEnd;
+        }
+        pthread_mutex_unlock(&shard.mutex);
+    }
+}
+
+
+/**
+ * @brief Append the hits of a word to its posting list in a shard.
+ * The posting list is grown at most once to fit all the hits.
+ * @param shard the shard.
+ * @param i_wordId the word id in the shard.
+ * @param first the first hit to append.
+ * @param last the end of the hits to append.
+ * @param retiredPostings the vector the replaced posting list is appended to.
+ * The lock of the shard MUST be held when calling this function.
+ */
+void DeltaSegment::appendToShard(DeltaShard &shard, u_int32_t i_wordId,
+                                 vector<WordHit>::const_iterator first,
+                                 vector<WordHit>::const_iterator last,
+                                 vector<DeltaPostings *> &retiredPostings)
+{
+    DeltaPostings *postings = shard.words[i_wordId].load(memory_order_relaxed);
+    const u_int32_t i_nbHits = postings != NULL
+        ? postings->i_nbHits.load(memory_order_relaxed) : 0;
+    const u_int32_t i_newNbHits = i_nbHits + (last - first);
+
+    if (postings == NULL || i_newNbHits > postings->i_capacity)
+    {
+        u_int32_t i_capacity = postings != NULL
+            ? 2 * postings->i_capacity : DELTA_POSTINGS_MIN_CAPACITY;
+        while (i_capacity < i_newNbHits)
+            i_capacity *= 2;
+
+        DeltaPostings *newPostings = new DeltaPostings(i_capacity);
+        if (postings != NULL)
+        {
+            copy(postings->p_hits, postings->p_hits + i_nbHits, newPostings->p_hits);
+            retiredPostings.push_back(postings);
+        }
+        newPostings->i_nbHits.store(i_nbHits, memory_order_relaxed);
+        shard.words[i_wordId].store(newPostings, memory_order_release);
+        postings = newPostings;
+    }
+
+    // The hits are written before the new size is published to the searches.
+    Hit *p_hit = postings->p_hits + i_nbHits;
+    for (; first != last; ++first)
+        *p_hit++ = first->hit;
+    postings->i_nbHits.store(i_newNbHits, memory_order_release);
+}
+
+
+BaseSegment::BaseSegment()
+    : offsets(new u_int64_t[NB_VISUAL_WORDS + 1]()), hits(NULL), hitsBuffer(NULL),
+      packedOffsets(NULL), packedIds(NULL), payloads(NULL), mappedIndex(NULL)
+{ }
+
+
+BaseSegment::~BaseSegment()
+{
+    delete[] offsets;
+    delete[] hitsBuffer;
+    delete[] packedOffsets;
+    delete[] packedIds;
+    delete[] payloads;
+    delete mappedIndex;
+}
+
+
+/**
+ * @brief Return the hits of a word.
+ * @param i_wordId the word id.
+ * @return the hits.
+ */
+WordHits BaseSegment::getHits(u_int32_t i_wordId) const
+{
+    WordHits wordHits;
+    const u_int64_t i_nbHits = offsets[i_wordId + 1] - offsets[i_wordId];
+
+    if (packedIds != NULL)
+        wordHits.packedBase = PackedHitSpan(packedIds + packedOffsets[i_wordId],
+                                            payloads + offsets[i_wordId], i_nbHits);
+    else
+        wordHits.segments[BASE_SEGMENT] = HitSpan(hits + offsets[i_wordId], i_nbHits);
+
+    return wordHits;
+}
+
+
+IndexEpoch::~IndexEpoch()
+{
+    for (unsigned i = 0; i < retiredPostings.size(); ++i)
+        delete retiredPostings[i];
+    if (!retiredSlots.empty())
+        slots->releaseSlots(retiredSlots);
+
+    /* The following epochs that are not used anymore are freed one after
+     * the other instead of recursively: the nested destructors only queue
+     * their next epoch in the list of the outermost one. */
+    static __thread vector<shared_ptr<IndexEpoch> > *pendingEpochs = NULL;
+    if (pendingEpochs != NULL)
+    {
+        pendingEpochs->push_back(next);
+        return;
+    }
+
+    vector<shared_ptr<IndexEpoch> > epochs(1, next);
+    pendingEpochs = &epochs;
+    next.reset();
+    while (!epochs.empty())
+    {
+        shared_ptr<IndexEpoch> epoch = epochs.back();
+        epochs.pop_back();
+    }
+    pendingEpochs = NULL;
+}
@@ -22,6 +22,8 @@
 #include <iostream>
 #include <set>
 #include <unordered_set>
+#include <atomic>
+#include <algorithm>
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -31,13 +33,134 @@
 #include <imageloader.h>
 
 
-ORBFeatureExtractor::ORBFeatureExtractor(ORBIndex *index, ORBWordIndex *wordIndex)
-    : index(index), wordIndex(wordIndex), orb(ORB::create(2000, 1.02, 100))
+ORBFeatureExtractor::ORBFeatureExtractor(ORBIndex *index, ORBWordIndex *wordIndex,
+                                         ThreadPool *threadPool)
+    : index(index), wordIndex(wordIndex), threadPool(threadPool),
+      orb(ORB::create(2000, 1.02, 100))
 { }
 
 
 u_int32_t ORBFeatureExtractor::processNewImage(unsigned i_imageId, unsigned i_imgSize,
                                                char *p_imgData, unsigned &i_nbFeaturesExtracted)
+{
+    list<HitForward> imageHits;
+    u_int32_t i_ret = extractHits(i_imageId, i_imgSize, p_imgData,
+                                  imageHits, i_nbFeaturesExtracted);
+    if (i_ret != OK)
+        return i_ret;
+
+    // Record the hits.
+    return index->addImage(i_imageId, imageHits);
+}
+
+
+/**
+ * @brief The ExtractionTask class
+ * Extracts the hits of the images of a batch. The tasks take the
+ * images one by one from a shared counter so that the large images do
+ * not delay the end of the batch.
+ */
+class ExtractionTask : public PoolTask
+{
+public:
+    ExtractionTask(ORBFeatureExtractor *extractor, const vector<unsigned> &imageIds,
+                     const vector<unsigned> &imgSizes, const vector<char *> &imgData,
+                     vector<u_int32_t> &results, vector<unsigned> &nbFeaturesExtracted,
+                     vector<list<HitForward> > &hitLists, atomic<unsigned> &i_nextImage)
+        : extractor(extractor), imageIds(imageIds), imgSizes(imgSizes), imgData(imgData),
+          results(results), nbFeaturesExtracted(nbFeaturesExtracted),
+          hitLists(hitLists), i_nextImage(i_nextImage) { }
+
+    void run()
+    {
+        unsigned i;
+        while ((i = i_nextImage++) < imageIds.size())
+            results[i] = extractor->extractHits(imageIds[i], imgSizes[i], imgData[i],
+                                                hitLists[i], nbFeaturesExtracted[i]);
+    }
+
+private:
+    ORBFeatureExtractor *extractor;
+    const vector<unsigned> &imageIds;
+    const vector<unsigned> &imgSizes;
+    const vector<char *> &imgData;
+    vector<u_int32_t> &results;
+    vector<unsigned> &nbFeaturesExtracted;
+    vector<list<HitForward> > &hitLists;
+    atomic<unsigned> &i_nextImage;
+};
+
+
+/**
+ * @brief Add a batch of images to the index.
+ * The features of the images are extracted by the thread pool and all the images
+ * that could be decoded are then added to the index at once.
+ * @param imageIds the image ids.
+ * @param imgSizes the sizes of the image data.
+ * @param imgData the image data.
+ * @param results the return code of each image.
+ * @param nbFeaturesExtracted the number of features extracted from each image.
+ * @return IMAGES_ADDED.
+ */
+u_int32_t ORBFeatureExtractor::processNewImages(const vector<unsigned> &imageIds,
+                                                const vector<unsigned> &imgSizes,
+                                                const vector<char *> &imgData,
+                                                vector<u_int32_t> &results,
+                                                vector<unsigned> &nbFeaturesExtracted)
+{
+    results.assign(imageIds.size(), OK);
+    nbFeaturesExtracted.assign(imageIds.size(), 0);
+    vector<list<HitForward> > hitLists(imageIds.size());
+
+    /* A thread of the pool is left to the searches so that their tasks do
+     * not wait for the end of a large batch. */
+    const unsigned i_nbPoolThreads = threadPool->getNbThreads();
+    const unsigned i_nbTasks = min((size_t)(i_nbPoolThreads > 1 ? i_nbPoolThreads - 1 : 1),
+                                   imageIds.size());
+    atomic<unsigned> i_nextImage(0);
+    vector<ExtractionTask *> tasks;
+    TaskGroup extractionTasks;
+    for (unsigned i = 0; i < i_nbTasks; ++i)
+    {
+        tasks.push_back(new ExtractionTask(this, imageIds, imgSizes, imgData, results,
+                                           nbFeaturesExtracted, hitLists, i_nextImage));
+        threadPool->submit(tasks.back(), extractionTasks);
+    }
+    extractionTasks.wait();
+    for (unsigned i = 0; i < tasks.size(); ++i)
+        delete tasks[i];
+
+    // Record the hits of the decoded images.
+    vector<unsigned> addedImageIds;
+    vector<list<HitForward> > addedHitLists;
+    for (unsigned i = 0; i < imageIds.size(); ++i)
+        if (results[i] == OK)
+        {
+            addedImageIds.push_back(imageIds[i]);
+            addedHitLists.push_back(list<HitForward>());
+            addedHitLists.back().swap(hitLists[i]);
+            results[i] = IMAGE_ADDED;
+        }
+
+    if (!addedImageIds.empty())
+        index->addImages(addedImageIds, addedHitLists);
+
+    return IMAGES_ADDED;
+}
+
+
+/**
+ * @brief Extract the hits of an image.
+ * @param i_imageId the image id.
+ * @param i_imgSize the size of the image data.
+ * @param p_imgData the image data.
+ * @param imageHits the list the hits are appended to.
+ * @param i_nbFeaturesExtracted the number of features extracted.
+ * @return OK if the image could be decoded.
+ */
+u_int32_t ORBFeatureExtractor::extractHits(unsigned i_imageId, unsigned i_imgSize,
+                                           char *p_imgData, list<HitForward> &imageHits,
+                                           unsigned &i_nbFeaturesExtracted)
 {
     Mat img;
     u_int32_t i_ret = ImageLoader::loadImage(i_imgSize, p_imgData, img);
@@ -53,7 +176,6 @@ u_int32_t ORBFeatureExtractor::processNewImage(unsigned i_imageId, unsigned i_im
     i_nbFeaturesExtracted = keypoints.size();
 
     unsigned i_nbKeyPoints = 0;
-    list<HitForward> imageHits;
     unordered_set<u_int32_t> matchedWords;
     for (unsigned i = 0; i < keypoints.size(); ++i)
     {
@@ -95,6 +217,5 @@ u_int32_t ORBFeatureExtractor::processNewImage(unsigned i_imageId, unsigned i_im
     waitKey();
 #endif
 
-    // Record the hits.
-    return index->addImage(i_imageId, imageHits);
+    return OK;
 }
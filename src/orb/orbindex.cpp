@@ -24,27 +24,147 @@
 #include <sstream>
 #include <cstdlib>
 #include <algorithm>
+#include <fstream>
 #include <sys/time.h>
 #include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <climits>
 
 #include <orbindex.h>
 #include <messages.h>
+#include <thread.h>
 
 
-ORBIndex::ORBIndex(string indexPath, bool buildForwardIndex)
-    : buildForwardIndex(buildForwardIndex)
+/**
+ * @brief The IndexMergeThread class
+ * This thread folds the delta segment of the index into a new base segment
+ * each time it is requested to.
+ */
+class IndexMergeThread : public Thread
 {
-    // Init the mutex.
+public:
+    IndexMergeThread(ORBIndex *index)
+        : index(index), b_mergeRequested(false), b_stop(false)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    virtual ~IndexMergeThread()
+    {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void requestMerge()
+    {
+        pthread_mutex_lock(&mutex);
+        b_mergeRequested = true;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void stop()
+    {
+        pthread_mutex_lock(&mutex);
+        b_stop = true;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+        join();
+    }
+
+private:
+    void *run()
+    {
+        pthread_mutex_lock(&mutex);
+        while (true)
+        {
+            while (!b_mergeRequested && !b_stop)
+                pthread_cond_wait(&cond, &mutex);
+            if (b_stop)
+                break;
+            b_mergeRequested = false;
+
+            pthread_mutex_unlock(&mutex);
+            index->mergeDelta();
+            pthread_mutex_lock(&mutex);
+        }
+        pthread_mutex_unlock(&mutex);
+
+        return NULL;
+    }
+
+    ORBIndex *index;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool b_mergeRequested;
+    bool b_stop;
+};
+
+
+ORBIndex::ORBIndex(string indexPath, bool buildForwardIndex, bool mapIndexFile,
+                   unsigned i_nbLoadingThreads, bool compressImageIds, bool buildForwardHits)
+    : buildForwardIndex(buildForwardIndex), mapIndexFile(mapIndexFile),
+      i_nbLoadingThreads(i_nbLoadingThreads), compressImageIds(compressImageIds),
+      buildForwardHits(buildForwardHits), b_autoMerge(true), i_nbImages(0), i_seq(0), i_lastSeq(0), b_writersBlocked(false),
+      b_mergeRunning(false)
+{
+    // The hits of a mapped index file are read in place.
+    if (mapIndexFile && compressImageIds)
+    {
+        cout << "The image ids are not compressed when the index file is mapped." << endl;
+        this->compressImageIds = false;
+    }
+
+    // Init the locks.
     pthread_rwlock_init(&rwLock, NULL);
+    pthread_mutex_init(&writeMutex, NULL);
+    pthread_mutex_init(&mergeMutex, NULL);
+    pthread_cond_init(&commitCond, NULL);
 
-    // Initialize the nbOccurences table.
-    for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
-        nbOccurences[i] = 0;
+    reset();
+    publishEpoch(epoch);
+
+    mergeThread = new IndexMergeThread(this);
+    mergeThread->start();
 
     load(indexPath);
 }
 
 
+/**
+ * @brief Get the forward hits of some images.
+ * The hits of an image removed since the snapshot are empty.
+ * @param snapshot the snapshot in which the slots are visible.
+ * @param slots the slots of the images.
+ * @param forwardHits a vector to return the hits of each slot.
+ * @return false if the forward hits are not kept by the index or if the
+ * index was cleared or loaded since the snapshot.
+ */
+bool ORBIndex::getSlotForwardHits(const IndexSnapshot &snapshot,
+                                  const vector<u_int32_t> &slots,
+                                  vector<shared_ptr<const ForwardHits> > &forwardHits)
+{
+    if (!buildForwardHits)
+        return false;
+
+    pthread_rwlock_rdlock(&rwLock);
+    // The slots are only reused by the images of the same slot table.
+    const bool b_sameSlots = snapshot.epoch->slots == epoch->slots;
+    if (b_sameSlots)
+    {
+        forwardHits.resize(slots.size());
+        for (unsigned i = 0; i < slots.size(); ++i)
+            forwardHits[i] = slotForwardHits[slots[i]];
+    }
+    pthread_rwlock_unlock(&rwLock);
+
+    return b_sameSlots;
+}
+
+
 /**
  * @brief Return the number of occurences of a word in an whole index.
  * @param i_wordId the word id.
@@ -52,101 +172,362 @@ ORBIndex::ORBIndex(string indexPath, bool buildForwardIndex)
  */
 unsigned ORBIndex::getWordNbOccurences(unsigned i_wordId)
 {
-    pthread_rwlock_rdlock(&rwLock);
     assert(i_wordId < NB_VISUAL_WORDS);
-    unsigned i_ret = nbOccurences[i_wordId];
-    pthread_rwlock_unlock(&rwLock);
-    return i_ret;
+    return nbOccurences[i_wordId].load(memory_order_relaxed);
+}
+
+
+/**
+ * @brief Return a lower bound of the number of words of the images that
+ * have a word.
+ * It gives the upper bound of the tf-idf contribution of the word to the
+ * score of an image.
+ * @param i_wordId the word id.
+ * @return the bound, UINT_MAX if no image was ever added with the word.
+ */
+unsigned ORBIndex::getWordMinNbWords(unsigned i_wordId)
+{
+    assert(i_wordId < NB_VISUAL_WORDS);
+    return wordMinNbWords[i_wordId].load(memory_order_relaxed);
 }
 
 
 ORBIndex::~ORBIndex()
 {
+    mergeThread->stop();
+    delete mergeThread;
+
+    publishedEpoch.reset();
+    epoch.reset();
+    pthread_cond_destroy(&commitCond);
+    pthread_mutex_destroy(&mergeMutex);
+    pthread_mutex_destroy(&writeMutex);
     pthread_rwlock_destroy(&rwLock);
 }
 
 
-void ORBIndex::getImagesWithVisualWords(unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
-                                     unordered_map<u_int32_t, vector<Hit> > &indexHitsForReq)
+/**
+ * @brief Pin the last published epoch of the index for a search.
+ * The searches do not take any lock: the segments of the epoch are not
+ * freed while the snapshot holds it and the modifications that are not
+ * complete when the snapshot is taken are ignored.
+ * @param snapshot the returned snapshot.
+ */
+void ORBIndex::getSnapshot(IndexSnapshot &snapshot)
 {
-    pthread_rwlock_rdlock(&rwLock);
+    snapshot.i_seq = i_seq.load(memory_order_acquire);
+    snapshot.epoch = atomic_load(&publishedEpoch);
+    // The base segment of a newer epoch already holds the later modifications.
+    snapshot.i_seq = max(snapshot.i_seq, snapshot.epoch->i_baseSeq);
+    snapshot.i_nbSlots = snapshot.epoch->slots->getNbSlots();
+}
+
+
+/**
+ * @brief Make an epoch the one pinned by the new searches.
+ * @param newEpoch the epoch.
+ * The write mutex and the index write lock MUST be held when calling
+ * this function.
+ */
+void ORBIndex::publishEpoch(shared_ptr<IndexEpoch> newEpoch)
+{
+    epoch = newEpoch;
+
+    shared_ptr<IndexEpoch> lastEpoch = atomic_load(&publishedEpoch);
+    if (lastEpoch && lastEpoch != newEpoch)
+        lastEpoch->next = newEpoch;
+    atomic_store(&publishedEpoch, newEpoch);
+}
 
+
+/**
+ * @brief Get the index hits of the words of a request without copying them.
+ * @param snapshot the snapshot of the index to search.
+ * @param imagesReqHits the request hits.
+ * @param indexHitsForReq the returned index hits for each word of the request.
+ * The returned hits stay valid as long as the snapshot is kept. They can
+ * hold hits of images that are not visible in the snapshot.
+ */
+void ORBIndex::getImagesWithVisualWords(const IndexSnapshot &snapshot,
+                                        unordered_map<u_int32_t, list<Hit> > &imagesReqHits,
+                                        unordered_map<u_int32_t, WordHits> &indexHitsForReq)
+{
     for (unordered_map<u_int32_t, list<Hit> >::const_iterator it = imagesReqHits.begin();
          it != imagesReqHits.end(); ++it)
     {
         const unsigned i_wordId = it->first;
-        indexHitsForReq[i_wordId] = indexHits[i_wordId];
+        indexHitsForReq[i_wordId] = getWordHits(*snapshot.epoch, i_wordId);
     }
+}
 
-    pthread_rwlock_unlock(&rwLock);
+
+/**
+ * @brief Return the hits of a word from the base and the delta segments.
+ * @param e the epoch.
+ * @param i_wordId the word id.
+ * @return the hits.
+ */
+WordHits ORBIndex::getWordHits(const IndexEpoch &e, unsigned i_wordId)
+{
+    WordHits hits = e.base->getHits(i_wordId);
+    hits.segments[DELTA_SEGMENT] = e.delta->getHits(i_wordId);
+    if (e.frozenDelta)
+        hits.segments[FROZEN_DELTA_SEGMENT] = e.frozenDelta->getHits(i_wordId);
+
+    return hits;
 }
 
 
 /**
- * @brief Return the number of words for an image
- * @param i_imageId the image id.
- * @return the number of words.
- * readLock() and unlock MUST be called before and after calling this function.
+ * @brief Get the hits of a word without the ones of the removed images and
+ * of the images that are being added.
+ * @param e the epoch.
+ * @param i_wordId the word id.
+ * @param hits the vector the hits are appended to.
+ * The index lock MUST be held when calling this function.
  */
-unsigned ORBIndex::countTotalNbWord(unsigned i_imageId)
+void ORBIndex::getLiveWordHits(const IndexEpoch &e, unsigned i_wordId, vector<Hit> &hits)
 {
-    unsigned i_ret = nbWords[i_imageId];
-    return i_ret;
+    const size_t i_start = hits.size();
+    getWordHits(e, i_wordId).getHits(hits);
+
+    vector<Hit>::iterator it = hits.begin() + i_start;
+    for (vector<Hit>::iterator it2 = it; it2 != hits.end(); ++it2)
+        if (slotStates[it2->i_imageId] == SLOT_LIVE)
+            *it++ = *it2;
+    hits.erase(it, hits.end());
 }
 
 
 unsigned ORBIndex::getTotalNbIndexedImages()
 {
-    pthread_rwlock_rdlock(&rwLock);
-    unsigned i_ret = nbWords.size();
-    pthread_rwlock_unlock(&rwLock);
-    return i_ret;
+    return i_nbImages;
 }
 
 
 /**
  * @brief Add a list of hits to the index.
+ * The hits are appended to the delta segment. Only the shards of the words
+ * of the image are locked meanwhile so that several images can be added
+ * at the same time.
  * @param  the list of hits.
  */
 u_int32_t ORBIndex::addImage(unsigned i_imageId, list<HitForward> hitList)
 {
+    vector<unsigned> imageIds(1, i_imageId);
+    vector<list<HitForward> > hitLists(1);
+    hitLists[0].swap(hitList);
+    return addImages(imageIds, hitLists);
+}
+
+
+/**
+ * @brief Add the hits of several images to the index at once.
+ * The images share one modification: their slots are reserved together,
+ * their hits are appended with one lock of each shard and one growth of
+ * each posting list, and they become visible to the searches at the same
+ * time. If an image id is given several times, the last one is kept.
+ * @param imageIds the image ids.
+ * @param hitLists the list of hits of each image.
+ */
+u_int32_t ORBIndex::addImages(const vector<unsigned> &imageIds,
+                              const vector<list<HitForward> > &hitLists)
+{
+    assert(imageIds.size() == hitLists.size());
+
+    // Reserve a sequence number and the slots of the images.
+    pthread_mutex_lock(&writeMutex);
+    const u_int64_t i_writeSeq = beginWrite();
+    shared_ptr<DeltaSegment> delta = epoch->delta;
+    vector<u_int32_t> slots(imageIds.size());
+    size_t i_nbHits = 0;
     pthread_rwlock_wrlock(&rwLock);
-    if (nbWords.find(i_imageId) != nbWords.end())
-    {
-        pthread_rwlock_unlock(&rwLock);
-        removeImage(i_imageId);
-        pthread_rwlock_wrlock(&rwLock);
-    }
+    for (unsigned i = 0; i < imageIds.size(); ++i)
+        if (!hitLists[i].empty())
+        {
+            slots[i] = reserveSlot(imageIds[i], hitLists[i].size(), i_writeSeq);
+            i_nbHits += hitLists[i].size();
+        }
+    pthread_rwlock_unlock(&rwLock);
+    pthread_mutex_unlock(&writeMutex);
+
+    // The hits are sorted by word id so that each shard is locked only once.
+    vector<WordHit> wordHits;
+    wordHits.reserve(i_nbHits);
+    for (unsigned i = 0; i < imageIds.size(); ++i)
+        for (list<HitForward>::const_iterator it = hitLists[i].begin();
+             it != hitLists[i].end(); ++it)
+        {
+            const HitForward &hitFor = *it;
+            assert(imageIds[i] == hitFor.i_imageId);
+            WordHit wordHit;
+            wordHit.i_wordId = hitFor.i_wordId;
+            wordHit.hit.i_imageId = slots[i];
+            wordHit.hit.i_angle = hitFor.i_angle;
+            wordHit.hit.x = hitFor.x;
+            wordHit.hit.y = hitFor.y;
+            wordHits.push_back(wordHit);
+
+            nbOccurences[hitFor.i_wordId]++;
+            lowerWordMinNbWords(hitFor.i_wordId, hitLists[i].size());
+        }
+    sort(wordHits.begin(), wordHits.end());
 
-    for (list<HitForward>::iterator it = hitList.begin(); it != hitList.end(); ++it)
-    {
-        HitForward hitFor = *it;
-        assert(i_imageId == hitFor.i_imageId);
-        Hit hitBack;
-        hitBack.i_imageId = hitFor.i_imageId;
-        hitBack.i_angle = hitFor.i_angle;
-        hitBack.x = hitFor.x;
-        hitBack.y = hitFor.y;
+    vector<shared_ptr<const ForwardHits> > forwardHits(imageIds.size());
+    if (buildForwardHits)
+        for (unsigned i = 0; i < imageIds.size(); ++i)
+            forwardHits[i] = makeForwardHits(hitLists[i]);
+
+    vector<DeltaPostings *> retiredPostings;
+    delta->append(wordHits, retiredPostings);
 
-        if (buildForwardIndex)
+    // Commit the images once the previous modifications are committed.
+    pthread_mutex_lock(&writeMutex);
+    waitForCommitTurn(i_writeSeq);
+    pthread_rwlock_wrlock(&rwLock);
+
+    for (unsigned i = 0; i < imageIds.size(); ++i)
+    {
+        /* The hits of a previous image with the same id are left to the next
+         * merge since the new image gets a new slot. */
+        unordered_map<u_int32_t, u_int32_t>::const_iterator slotIt = imageSlots.find(imageIds[i]);
+        if (slotIt != imageSlots.end())
+            removeSlot(slotIt->second, i_writeSeq);
+
+        const list<HitForward> &hitList = hitLists[i];
+        if (!hitList.empty())
         {
-            forwardIndex[hitFor.i_imageId].push_back(hitFor.i_wordId);
+            const u_int32_t i_slot = slots[i];
+            activateSlot(i_slot, imageIds[i], hitList.size());
+            if (buildForwardIndex)
+            {
+                slotWords[i_slot].reserve(hitList.size());
+                for (list<HitForward>::const_iterator it = hitList.begin(); it != hitList.end(); ++it)
+                    slotWords[i_slot].push_back(it->i_wordId);
+            }
+            slotForwardHits[i_slot] = forwardHits[i];
+            totalNbRecords += hitList.size();
+            i_nbDeltaHits += hitList.size();
         }
-        indexHits[hitFor.i_wordId].push_back(hitBack);
-        nbWords[hitFor.i_imageId]++;
-        nbOccurences[hitFor.i_wordId]++;
-        totalNbRecords++;
     }
+
+    /* The posting lists replaced by larger ones are freed with the current
+     * epoch once no search uses it anymore. */
+    if (!retiredPostings.empty())
+    {
+        epoch->retiredPostings.insert(epoch->retiredPostings.end(),
+                                      retiredPostings.begin(), retiredPostings.end());
+        publishEpoch(make_shared<IndexEpoch>(epoch->base, epoch->delta, epoch->slots,
+                                             epoch->i_baseSeq, epoch->frozenDelta));
+    }
+
+    const bool b_mustMerge = mustMergeDelta();
     pthread_rwlock_unlock(&rwLock);
+    endWrite(i_writeSeq);
+    pthread_mutex_unlock(&writeMutex);
+
+    if (b_mustMerge)
+        mergeThread->requestMerge();
 
-    if (!hitList.empty())
-        cout << "Image " << hitList.begin()->i_imageId << " added: "
-             << hitList.size() << " hits." << endl;
+    if (imageIds.size() == 1)
+    {
+        if (!hitLists[0].empty())
+            cout << "Image " << imageIds[0] << " added: "
+                 << hitLists[0].size() << " hits." << endl;
+    }
+    else
+        cout << imageIds.size() << " images added: " << i_nbHits << " hits." << endl;
 
     return IMAGE_ADDED;
 }
 
 
+/**
+ * @brief Build the forward hits of an image.
+ * @param hitList the hits of the image.
+ * @return the hits sorted by word id.
+ */
+shared_ptr<const ForwardHits> ORBIndex::makeForwardHits(const list<HitForward> &hitList)
+{
+    shared_ptr<ForwardHits> forwardHits = make_shared<ForwardHits>();
+    forwardHits->reserve(hitList.size());
+    for (list<HitForward>::const_iterator it = hitList.begin(); it != hitList.end(); ++it)
+    {
+        ForwardHit forwardHit;
+        forwardHit.i_wordId = it->i_wordId;
+        forwardHit.i_angle = it->i_angle;
+        forwardHit.x = it->x;
+        forwardHit.y = it->y;
+        forwardHits->push_back(forwardHit);
+    }
+    stable_sort(forwardHits->begin(), forwardHits->end());
+    return forwardHits;
+}
+
+
+/**
+ * @brief Start a modification of the images.
+ * @return the sequence number of the modification.
+ * The write mutex MUST be held when calling this function.
+ */
+u_int64_t ORBIndex::beginWrite()
+{
+    while (b_writersBlocked)
+        pthread_cond_wait(&commitCond, &writeMutex);
+    return ++i_lastSeq;
+}
+
+
+/**
+ * @brief Wait until all the modifications that started before a given one
+ * are committed.
+ * @param i_writeSeq the sequence number of the modification.
+ * The write mutex MUST be held when calling this function.
+ */
+void ORBIndex::waitForCommitTurn(u_int64_t i_writeSeq)
+{
+    while (i_seq != i_writeSeq - 1)
+        pthread_cond_wait(&commitCond, &writeMutex);
+}
+
+
+/**
+ * @brief Commit a modification of the images.
+ * It becomes visible to the new snapshots.
+ * @param i_writeSeq the sequence number of the modification.
+ * The write mutex MUST be held when calling this function.
+ */
+void ORBIndex::endWrite(u_int64_t i_writeSeq)
+{
+    i_seq.store(i_writeSeq, memory_order_release);
+    pthread_cond_broadcast(&commitCond);
+}
+
+
+/**
+ * @brief Prevent the modifications of the images from starting and wait
+ * for the end of the running ones.
+ * The write mutex MUST be held when calling this function.
+ */
+void ORBIndex::blockWriters()
+{
+    b_writersBlocked = true;
+    while (i_seq != i_lastSeq)
+        pthread_cond_wait(&commitCond, &writeMutex);
+}
+
+
+/**
+ * @brief Let the modifications of the images start again.
+ * The write mutex MUST be held when calling this function.
+ */
+void ORBIndex::unblockWriters()
+{
+    b_writersBlocked = false;
+    pthread_cond_broadcast(&commitCond);
+}
+
+
 /**
  * @brief Add a string tag to an image.
  * @param  the tag to add.
@@ -155,12 +536,13 @@ u_int32_t ORBIndex::addTag(const unsigned i_imageId, const string tag)
 {
     pthread_rwlock_wrlock(&rwLock);
 
-    if (nbWords.find(i_imageId) == nbWords.end()) {
+    unordered_map<u_int32_t, u_int32_t>::const_iterator slotIt = imageSlots.find(i_imageId);
+    if (slotIt == imageSlots.end()) {
         pthread_rwlock_unlock(&rwLock);
         return IMAGE_NOT_FOUND;
     }
 
-    tags[i_imageId] = tag;
+    slotTags[slotIt->second] = tag;
 
     pthread_rwlock_unlock(&rwLock);
 
@@ -180,56 +562,447 @@ u_int32_t ORBIndex::removeImage(const unsigned i_imageId)
     // First remove the image tag if there is one.
     removeTag((u_int64_t)i_imageId);
 
+    pthread_mutex_lock(&writeMutex);
+    const u_int64_t i_writeSeq = beginWrite();
+    waitForCommitTurn(i_writeSeq);
     pthread_rwlock_wrlock(&rwLock);
-    unordered_map<u_int64_t, unsigned>::iterator imgIt =
-        nbWords.find(i_imageId);
 
-    if (imgIt == nbWords.end())
+    unordered_map<u_int32_t, u_int32_t>::const_iterator slotIt = imageSlots.find(i_imageId);
+    if (slotIt == imageSlots.end())
     {
         cout << "Image " << i_imageId << " not found." << endl;
         pthread_rwlock_unlock(&rwLock);
+        endWrite(i_writeSeq);
+        pthread_mutex_unlock(&writeMutex);
         return IMAGE_NOT_FOUND;
     }
 
-    nbWords.erase(imgIt);
+    removeSlot(slotIt->second, i_writeSeq);
 
-    if (buildForwardIndex)
+    const bool b_mustMerge = mustMergeDelta();
+    pthread_rwlock_unlock(&rwLock);
+    endWrite(i_writeSeq);
+    pthread_mutex_unlock(&writeMutex);
+
+    if (b_mustMerge)
+        mergeThread->requestMerge();
+
+    cout << "Image " << i_imageId << " removed." << endl;
+
+    return IMAGE_REMOVED;
+}
+
+
+/**
+ * @brief Give a slot to a new image.
+ * @param i_imageId the image id.
+ * @param i_nbWords the number of words of the image.
+ * @param i_addSeq the sequence number from which the image is visible.
+ * @return the slot.
+ * The write mutex and the index write lock MUST be held when calling
+ * this function.
+ */
+u_int32_t ORBIndex::addSlot(u_int32_t i_imageId, unsigned i_nbWords, u_int64_t i_addSeq)
+{
+    const u_int32_t i_slot = reserveSlot(i_imageId, i_nbWords, i_addSeq);
+    activateSlot(i_slot, i_imageId, i_nbWords);
+    return i_slot;
+}
+
+
+/**
+ * @brief Reserve a slot for an image whose hits are going to be added.
+ * The released slots are reused first. The slot stays free for the
+ * other functions than the searches until it is activated.
+ * @param i_imageId the image id.
+ * @param i_nbWords the number of words of the image.
+ * @param i_addSeq the sequence number from which the image is visible.
+ * @return the slot.
+ * The write mutex and the index write lock MUST be held when calling
+ * this function.
+ */
+u_int32_t ORBIndex::reserveSlot(u_int32_t i_imageId, unsigned i_nbWords, u_int64_t i_addSeq)
+{
+    const u_int32_t i_slot = epoch->slots->acquireSlot();
+    if (i_slot == slotStates.size())
     {
-        unordered_map<u_int64_t, vector<unsigned> >::iterator forwardIndexIt =
-            forwardIndex.find(i_imageId);
+        slotStates.push_back(SLOT_FREE);
+        slotNbWords.push_back(0);
+        slotTags.push_back(string());
+        slotWords.push_back(vector<unsigned>());
+        slotForwardHits.push_back(shared_ptr<const ForwardHits>());
+    }
+
+    /* The searches only read the slot once they have found one of its hits
+     * so it is filled before the hits are added. */
+    SlotInfo &slot = epoch->slots->getSlot(i_slot);
+    slot.i_imageId = i_imageId;
+    slot.f_invNbWords = 1.0f / i_nbWords;
+    slot.i_removeSeq.store(SLOT_NEVER_REMOVED, memory_order_relaxed);
+    slot.i_addSeq.store(i_addSeq, memory_order_relaxed);
+
+    return i_slot;
+}
+
+
+/**
+ * @brief Make the image of a reserved slot live.
+ * @param i_slot the slot.
+ * @param i_imageId the image id.
+ * @param i_nbWords the number of words of the image.
+ * The index write lock MUST be held when calling this function.
+ */
+void ORBIndex::activateSlot(u_int32_t i_slot, u_int32_t i_imageId, unsigned i_nbWords)
+{
+    slotStates[i_slot] = SLOT_LIVE;
+    slotNbWords[i_slot] = i_nbWords;
+    imageSlots[i_imageId] = i_slot;
+    i_nbImages++;
+}
 
-        if (forwardIndexIt == forwardIndex.end())
-        {
-            cout << "Image " << i_imageId << " not found." << endl;
-            pthread_rwlock_unlock(&rwLock);
-            return IMAGE_NOT_FOUND;
-        }
 
-        forwardIndex.erase(forwardIndexIt);
+/**
+ * @brief Mark the image of a slot as removed.
+ * Its hits stay in the segments but are skipped by the searches until
+ * they are purged by the next merge that also frees the slot.
+ * @param i_slot the slot.
+ * @param i_removeSeq the sequence number from which the image is not visible.
+ * The write mutex and the index write lock MUST be held when calling
+ * this function.
+ */
+void ORBIndex::removeSlot(u_int32_t i_slot, u_int64_t i_removeSeq)
+{
+    SlotInfo &slot = epoch->slots->getSlot(i_slot);
+    slot.i_removeSeq.store(i_removeSeq, memory_order_relaxed);
+
+    imageSlots.erase(slot.i_imageId);
+    slotStates[i_slot] = SLOT_REMOVED;
+    slotTags[i_slot].clear();
+    vector<unsigned>().swap(slotWords[i_slot]);
+    slotForwardHits[i_slot].reset();
+
+    i_nbImages--;
+    i_nbRemovedSlots++;
+    i_nbDeadHits += slotNbWords[i_slot];
+    totalNbRecords -= slotNbWords[i_slot];
+}
+
+
+/**
+ * @brief Enable or disable the automatic merges of the delta segment.
+ * A builder that writes the index once all the images are added does not
+ * need them since the index file is written from both segments.
+ * @param b_enabled true to merge the delta segment when it is too large.
+ */
+void ORBIndex::setAutoMerge(bool b_enabled)
+{
+    pthread_mutex_lock(&writeMutex);
+    b_autoMerge = b_enabled;
+    pthread_mutex_unlock(&writeMutex);
+}
+
+
+/**
+ * @brief Lower the bound of the number of words of the images of a word.
+ * @param i_wordId the word id.
+ * @param i_nbWords the number of words of an image added with the word.
+ */
+void ORBIndex::lowerWordMinNbWords(unsigned i_wordId, unsigned i_nbWords)
+{
+    unsigned i_min = wordMinNbWords[i_wordId].load(memory_order_relaxed);
+    while (i_nbWords < i_min
+           && !wordMinNbWords[i_wordId].compare_exchange_weak(i_min, i_nbWords,
+                                                              memory_order_relaxed))
+        ;
+}
+
+
+/**
+ * @brief Return the smallest number of words of the images of a list of hits.
+ * @param hits the hits of live images.
+ * @return the number of words, UINT_MAX if the list is empty.
+ * The index lock MUST be held when calling this function.
+ */
+unsigned ORBIndex::getMinNbWords(const vector<Hit> &hits)
+{
+    unsigned i_min = UINT_MAX;
+    for (vector<Hit>::const_iterator it = hits.begin(); it != hits.end(); ++it)
+        i_min = min(i_min, slotNbWords[it->i_imageId]);
+    return i_min;
+}
+
+
+/**
+ * @brief Test if the delta segment and the dead hits have grown enough
+ * to be merged.
+ * @return true if a merge must be requested.
+ * The index lock MUST be held when calling this function.
+ */
+bool ORBIndex::mustMergeDelta()
+{
+    return b_autoMerge && !b_mergeRunning
+        && i_nbDeltaHits + i_nbDeadHits >= max((u_int64_t)DELTA_MERGE_MIN_NB_HITS,
+                                               totalNbRecords / DELTA_MERGE_RATIO);
+}
+
+
+/**
+ * @brief Compare two hits according to their image ids.
+ */
+static bool compareHitImageIds(const Hit &a, const Hit &b)
+{
+    return a.i_imageId < b.i_imageId;
+}
+
+
+/**
+ * @brief Compress the image ids of a base segment.
+ * The hits of each word are first sorted by image id so that the ids can
+ * be delta encoded.
+ * @param offsets the offsets of the words in the hits.
+ * @param hits the hits of the base segment.
+ * @param packedOffsets the returned offsets of the words in packedIds.
+ * @param packedIds the returned encoded image ids.
+ * @param payloads the returned payloads of the hits.
+ */
+static void packBaseHits(const u_int64_t *offsets, Hit *hits,
+                         u_int64_t *&packedOffsets, u_int8_t *&packedIds,
+                         HitPayload *&payloads)
+{
+    const u_int64_t i_nbHits = offsets[NB_VISUAL_WORDS];
+    vector<u_int32_t> imageIds;
+
+    // Sort the hits and compute the size of the encoded ids.
+    packedOffsets = new u_int64_t[NB_VISUAL_WORDS + 1];
+    u_int64_t i_packedSize = 0;
+    for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+    {
+        Hit *wordHits = hits + offsets[i_wordId];
+        const u_int64_t i_nbWordHits = offsets[i_wordId + 1] - offsets[i_wordId];
+        sort(wordHits, wordHits + i_nbWordHits, compareHitImageIds);
+
+        imageIds.resize(i_nbWordHits);
+        for (u_int64_t i = 0; i < i_nbWordHits; ++i)
+            imageIds[i] = wordHits[i].i_imageId;
+
+        packedOffsets[i_wordId] = i_packedSize;
+        i_packedSize += PostingCodec::encodedSize(imageIds.data(), i_nbWordHits);
     }
+    packedOffsets[NB_VISUAL_WORDS] = i_packedSize;
 
+    // The decoder may read a few bytes after the end of the last word.
+    packedIds = new u_int8_t[i_packedSize + POSTING_CODEC_PADDING]();
+    payloads = new HitPayload[i_nbHits];
     for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
     {
-        vector<Hit> &hits = indexHits[i_wordId];
-        vector<Hit>::iterator it = hits.begin();
+        const u_int64_t i_nbWordHits = offsets[i_wordId + 1] - offsets[i_wordId];
+        imageIds.resize(i_nbWordHits);
+        for (u_int64_t i = offsets[i_wordId]; i < offsets[i_wordId + 1]; ++i)
+        {
+            imageIds[i - offsets[i_wordId]] = hits[i].i_imageId;
+            payloads[i].i_angle = hits[i].i_angle;
+            payloads[i].x = hits[i].x;
+            payloads[i].y = hits[i].y;
+        }
+        PostingCodec::encode(imageIds.data(), i_nbWordHits,
+                             packedIds + packedOffsets[i_wordId]);
+    }
+}
+
 
-        while (it != hits.end())
+/**
+ * @brief Gather the live hits of the merged segments in a new base segment.
+ * @param mergedEpoch the epoch whose base and frozen delta segments are merged.
+ * @param mergedSlotStates the states of the slots when the delta segment was frozen.
+ * @param newBase the new base segment whose offsets are filled.
+ * @param hitsOfs the stream where the hits are written or NULL to copy them
+ * to the hits buffer of newBase.
+ * @param wordNbPurgedHits the returned number of purged hits of the words that have some.
+ * @return the number of purged hits.
+ */
+static u_int64_t gatherMergedHits(const IndexEpoch &mergedEpoch,
+                                  const vector<u_int8_t> &mergedSlotStates,
+                                  BaseSegment &newBase, ofstream *hitsOfs,
+                                  vector<pair<unsigned, u_int64_t> > &wordNbPurgedHits)
+{
+    u_int64_t i_offset = 0;
+    u_int64_t i_nbPurgedHits = 0;
+    vector<Hit> wordHits;
+    for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+    {
+        newBase.offsets[i_wordId] = i_offset;
+
+        // The new delta segment is skipped since it is being modified.
+        WordHits mergedHits = mergedEpoch.base->getHits(i_wordId);
+        mergedHits.segments[FROZEN_DELTA_SEGMENT] = mergedEpoch.frozenDelta->getHits(i_wordId);
+        wordHits.clear();
+        mergedHits.getHits(wordHits);
+        const u_int64_t i_nbWordHits = wordHits.size();
+
+        vector<Hit>::iterator it = wordHits.begin();
+        for (vector<Hit>::iterator it2 = it; it2 != wordHits.end(); ++it2)
+            if (mergedSlotStates[it2->i_imageId] == SLOT_LIVE)
+                *it++ = *it2;
+        wordHits.erase(it, wordHits.end());
+
+        if (wordHits.size() != i_nbWordHits)
         {
-            if (it->i_imageId == i_imageId)
-            {
-                totalNbRecords--;
-                nbOccurences[i_wordId]--;
-                hits.erase(it);
-                break;
-            }
-            ++it;
+            wordNbPurgedHits.push_back(make_pair(i_wordId, i_nbWordHits - wordHits.size()));
+            i_nbPurgedHits += i_nbWordHits - wordHits.size();
         }
+
+        if (hitsOfs != NULL)
+            hitsOfs->write((char *)wordHits.data(), wordHits.size() * BACKWARD_INDEX_ENTRY_SIZE);
+        else
+            copy(wordHits.begin(), wordHits.end(), newBase.hitsBuffer + i_offset);
+        i_offset += wordHits.size();
+    }
+    newBase.offsets[NB_VISUAL_WORDS] = i_offset;
+
+    return i_nbPurgedHits;
+}
+
+
+/**
+ * @brief Fold the delta segment into a new base segment and purge the
+ * dead hits of the removed images.
+ * The delta segment is first frozen and replaced by an empty one that
+ * receives the new modifications. The new base segment is then built
+ * without lock from the frozen segments and the slot states captured at
+ * that point, and finally published in a new epoch so that neither the
+ * searches nor the writers are stalled. The images removed during the
+ * build are purged by the next merge. The slots of the purged images are
+ * released with the previous epoch once no search can see their hits
+ * anymore.
+ * The hits of a merged mapped index file are written to a new file next to
+ * it that is mapped in turn, so that they stay in the page cache instead of
+ * being copied to the memory of the process.
+ */
+void ORBIndex::mergeDelta()
+{
+    pthread_mutex_lock(&mergeMutex);
+    pthread_mutex_lock(&writeMutex);
+    blockWriters();
+
+    if (i_nbDeltaHits == 0 && i_nbRemovedSlots == 0)
+    {
+        unblockWriters();
+        pthread_mutex_unlock(&writeMutex);
+        pthread_mutex_unlock(&mergeMutex);
+        return;
     }
+
+    cout << "Merging " << i_nbDeltaHits << " hits of the delta segment and purging "
+         << i_nbDeadHits << " dead hits." << endl;
+
+    timeval t[2];
+    gettimeofday(&t[0], NULL);
+
+    // Freeze the delta segment once the running modifications are committed.
+    pthread_rwlock_wrlock(&rwLock);
+
+    const vector<u_int8_t> mergedSlotStates = slotStates;
+    vector<u_int32_t> purgedSlots;
+    for (u_int32_t i_slot = 0; i_slot < slotStates.size(); ++i_slot)
+        if (slotStates[i_slot] == SLOT_REMOVED)
+            purgedSlots.push_back(i_slot);
+    const u_int64_t i_mergedNbRecords = totalNbRecords;
+    const u_int64_t i_mergedSeq = i_seq.load();
+
+    publishEpoch(make_shared<IndexEpoch>(epoch->base, make_shared<DeltaSegment>(),
+                                         epoch->slots, epoch->i_baseSeq, epoch->delta));
+    const shared_ptr<IndexEpoch> mergedEpoch = epoch; // Pins the merged segments.
+    i_nbDeltaHits = 0;
+    b_mergeRunning = true;
+
     pthread_rwlock_unlock(&rwLock);
+    unblockWriters();
+    pthread_mutex_unlock(&writeMutex);
 
-    cout << "Image " << i_imageId << " removed." << endl;
+    // Build the new base segment with the hits of the images live at that point.
+    shared_ptr<BaseSegment> newBase = make_shared<BaseSegment>();
+    vector<pair<unsigned, u_int64_t> > wordNbPurgedHits;
+    u_int64_t i_nbPurgedHits = 0;
+    const u_int64_t i_nbMergedBytes = i_mergedNbRecords * BACKWARD_INDEX_ENTRY_SIZE;
 
-    return IMAGE_REMOVED;
+    if (mergedEpoch->base->mappedIndex != NULL && i_mergedNbRecords > 0)
+    {
+        const string mergedIndexPath = mappedIndexPath + ".merged";
+        cout << "Writing " << i_nbMergedBytes << " bytes of hits to "
+             << mergedIndexPath << "." << endl;
+
+        ofstream ofs(mergedIndexPath.c_str(), ios_base::binary);
+        if (ofs.good())
+            i_nbPurgedHits = gatherMergedHits(*mergedEpoch, mergedSlotStates, *newBase,
+                                              &ofs, wordNbPurgedHits);
+        ofs.close();
+
+        BackwardIndexReaderMmapAccess *mergedIndex = new BackwardIndexReaderMmapAccess();
+        if (ofs.good() && mergedIndex->open(mergedIndexPath))
+        {
+            newBase->mappedIndex = mergedIndex;
+            newBase->hits = (const Hit *)mergedIndex->getData(0);
+        }
+        else
+        {
+            cout << "Could not write the merged hits file." << endl;
+            delete mergedIndex;
+            wordNbPurgedHits.clear();
+        }
+        // The mapping keeps the content of the file once it is removed.
+        unlink(mergedIndexPath.c_str());
+    }
+
+    if (newBase->mappedIndex == NULL)
+    {
+        if (mergedEpoch->base->mappedIndex != NULL)
+            cout << "Copying " << i_nbMergedBytes
+                 << " bytes of hits of the mapped index file to memory." << endl;
+
+        newBase->hitsBuffer = new Hit[i_mergedNbRecords];
+        i_nbPurgedHits = gatherMergedHits(*mergedEpoch, mergedSlotStates, *newBase,
+                                          NULL, wordNbPurgedHits);
+
+        if (compressImageIds)
+        {
+            packBaseHits(newBase->offsets, newBase->hitsBuffer, newBase->packedOffsets,
+                         newBase->packedIds, newBase->payloads);
+            delete[] newBase->hitsBuffer;
+            newBase->hitsBuffer = NULL;
+        }
+        newBase->hits = newBase->hitsBuffer;
+    }
+    assert(newBase->offsets[NB_VISUAL_WORDS] == i_mergedNbRecords);
+
+    /* Replace the base and the frozen delta segments. The delta segment
+     * that received the modifications since the freeze is kept. */
+    pthread_mutex_lock(&writeMutex);
+    pthread_rwlock_wrlock(&rwLock);
+
+    epoch->retiredSlots.insert(epoch->retiredSlots.end(),
+                               purgedSlots.begin(), purgedSlots.end());
+    publishEpoch(make_shared<IndexEpoch>(newBase, epoch->delta, epoch->slots, i_mergedSeq));
+
+    for (unsigned i = 0; i < wordNbPurgedHits.size(); ++i)
+        nbOccurences[wordNbPurgedHits[i].first] -= wordNbPurgedHits[i].second;
+    for (unsigned i = 0; i < purgedSlots.size(); ++i)
+    {
+        assert(slotStates[purgedSlots[i]] == SLOT_REMOVED);
+        slotStates[purgedSlots[i]] = SLOT_FREE;
+        slotNbWords[purgedSlots[i]] = 0;
+    }
+    i_nbRemovedSlots -= purgedSlots.size();
+    i_nbDeadHits -= i_nbPurgedHits;
+    b_mergeRunning = false;
+
+    pthread_rwlock_unlock(&rwLock);
+    pthread_mutex_unlock(&writeMutex);
+    pthread_mutex_unlock(&mergeMutex);
+
+    gettimeofday(&t[1], NULL);
+    cout << "Merge done in " << ((t[1].tv_sec - t[0].tv_sec) * 1000
+                                 + (t[1].tv_usec - t[0].tv_usec) / 1000)
+         << " ms." << endl;
 }
 
 
@@ -239,45 +1012,40 @@ u_int32_t ORBIndex::removeImage(const unsigned i_imageId)
  */
 u_int32_t ORBIndex::getImageWords(unsigned i_imageId, unordered_map<u_int32_t, list<Hit> > &hitList)
 {
-    pthread_rwlock_wrlock(&rwLock);
+    pthread_rwlock_rdlock(&rwLock);
 
-    const unsigned i_nbTotalIndexedImages = getTotalNbIndexedImages();
+    const unsigned i_nbTotalIndexedImages = imageSlots.size();
     const unsigned i_maxNbOccurences = i_nbTotalIndexedImages > 10000 ?
                                        0.15 * i_nbTotalIndexedImages
                                        : i_nbTotalIndexedImages;
 
-    unordered_map<u_int64_t, unsigned>::iterator imgIt =
-        nbWords.find(i_imageId);
+    unordered_map<u_int32_t, u_int32_t>::const_iterator slotIt =
+        imageSlots.find(i_imageId);
 
-    if (imgIt == nbWords.end())
+    if (slotIt == imageSlots.end())
     {
         cout << "Image " << i_imageId << " not found." << endl;
         pthread_rwlock_unlock(&rwLock);
         return IMAGE_NOT_FOUND;
     }
+    const u_int32_t i_slot = slotIt->second;
 
     if (buildForwardIndex)
     {
-        vector<unsigned> &words = forwardIndex[i_imageId];
+        vector<unsigned> &words = slotWords[i_slot];
         vector<unsigned>::iterator word_it = words.begin();
 
         while (word_it != words.end())
         {
             unsigned i_wordId = *word_it;
 
-            if (getWordNbOccurences(i_wordId) <= i_maxNbOccurences)
+            if (nbOccurences[i_wordId] <= i_maxNbOccurences)
             {
-                vector<Hit> &hits = indexHits[i_wordId];
-                vector<Hit>::iterator hit_it = hits.begin();
-
-                while (hit_it != hits.end())
+                Hit hit;
+                if (getWordHits(*epoch, i_wordId).find(i_slot, hit))
                 {
-                    if (hit_it->i_imageId == i_imageId)
-                    {
-                        hitList[i_wordId].push_back(*hit_it);
-                        break;
-                    }
-                    ++hit_it;
+                    hit.i_imageId = i_imageId;
+                    hitList[i_wordId].push_back(hit);
                 }
             }
             ++word_it;
@@ -287,20 +1055,14 @@ u_int32_t ORBIndex::getImageWords(unsigned i_imageId, unordered_map<u_int32_t, l
     {
         for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
         {
-            vector<Hit> &hits = indexHits[i_wordId];
-            vector<Hit>::iterator it = hits.begin();
+            if (nbOccurences[i_wordId] > i_maxNbOccurences)
+                continue;
 
-            while (it != hits.end())
+            Hit hit;
+            if (getWordHits(*epoch, i_wordId).find(i_slot, hit))
             {
-                if (it->i_imageId == i_imageId)
-                {
-                    if (getWordNbOccurences(i_wordId) <= i_maxNbOccurences)
-                    {
-                        hitList[i_wordId].push_back(*it);
-                    }
-                    break;
-                }
-                ++it;
+                hit.i_imageId = i_imageId;
+                hitList[i_wordId].push_back(hit);
             }
         }
     }
@@ -320,15 +1082,15 @@ u_int32_t ORBIndex::removeTag(const unsigned i_imageId)
 {
     pthread_rwlock_wrlock(&rwLock);
 
-    unordered_map<u_int32_t, string>::iterator tagIt =
-        tags.find(i_imageId);
+    unordered_map<u_int32_t, u_int32_t>::const_iterator slotIt =
+        imageSlots.find(i_imageId);
 
-    if (tagIt == tags.end()) {
+    if (slotIt == imageSlots.end() || slotTags[slotIt->second].empty()) {
         pthread_rwlock_unlock(&rwLock);
         return IMAGE_TAG_NOT_FOUND;
     }
 
-    tags.erase(tagIt);
+    slotTags[slotIt->second].clear();
 
     pthread_rwlock_unlock(&rwLock);
 
@@ -347,15 +1109,15 @@ u_int32_t ORBIndex::getTag(const unsigned i_imageId, string &tag)
 {
     pthread_rwlock_rdlock(&rwLock);
 
-    unordered_map<u_int32_t, string>::iterator tagIt =
-        tags.find(i_imageId);
+    unordered_map<u_int32_t, u_int32_t>::const_iterator slotIt =
+        imageSlots.find(i_imageId);
 
-    if (tagIt == tags.end()) {
+    if (slotIt == imageSlots.end() || slotTags[slotIt->second].empty()) {
         pthread_rwlock_unlock(&rwLock);
         return IMAGE_TAG_NOT_FOUND;
     }
 
-    tag = tagIt->second;
+    tag = slotTags[slotIt->second];
 
     pthread_rwlock_unlock(&rwLock);
 
@@ -363,8 +1125,34 @@ u_int32_t ORBIndex::getTag(const unsigned i_imageId, string &tag)
 }
 
 
+/**
+ * @brief Round a position in the index file up to the next section boundary.
+ * @param i_pos the position.
+ * @return the aligned position.
+ */
+static u_int64_t alignSectionPos(u_int64_t i_pos)
+{
+    return (i_pos + BACKWARD_INDEX_SECTION_ALIGNMENT - 1)
+           / BACKWARD_INDEX_SECTION_ALIGNMENT * BACKWARD_INDEX_SECTION_ALIGNMENT;
+}
+
+
+/**
+ * @brief Write zeros up to the given position of the index file.
+ * @param ofs the index file stream.
+ * @param i_pos the position.
+ */
+static void writePadding(ofstream &ofs, u_int64_t i_pos)
+{
+    const char zero = 0;
+    for (u_int64_t i = ofs.tellp(); i < i_pos; ++i)
+        ofs.write(&zero, 1);
+}
+
+
 /**
  * @brief Write the index in memory to a file.
+ * The version 2 of the file format is always used.
  * @param backwardIndexPath
  * @return the operation code
  */
@@ -373,9 +1161,12 @@ u_int32_t ORBIndex::write(string backwardIndexPath)
     if (backwardIndexPath == "")
         backwardIndexPath = DEFAULT_INDEX_PATH;
 
+    /* Write first to a temporary file that then replaces the index file
+     * so that a memory mapped index file is never truncated. */
+    const string tmpIndexPath = backwardIndexPath + ".tmp";
     ofstream ofs;
 
-    ofs.open(backwardIndexPath.c_str(), ios_base::binary);
+    ofs.open(tmpIndexPath.c_str(), ios_base::binary);
     if (!ofs.good())
     {
         cout << "Could not open the backward index file." << endl;
@@ -384,30 +1175,98 @@ u_int32_t ORBIndex::write(string backwardIndexPath)
 
     pthread_rwlock_rdlock(&rwLock);
 
-    cout << "Writing the number of occurences." << endl;
-    for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
-        ofs.write((char *)(nbOccurences + i), sizeof(u_int64_t));
+    // Compute the position of the sections.
+    BackwardIndexHeader header;
+    memset(&header, 0, sizeof(BackwardIndexHeader));
+    memcpy(header.magic, BACKWARD_INDEX_MAGIC, sizeof(header.magic));
+    header.i_version = BACKWARD_INDEX_VERSION;
+    header.i_flags = buildForwardIndex ? BACKWARD_INDEX_FLAG_FORWARD_INDEX : 0;
+    header.i_nbWords = NB_VISUAL_WORDS;
+    header.i_nbImages = imageSlots.size();
+    header.i_nbHits = totalNbRecords;
+    header.i_wordOffsetsPos = alignSectionPos(sizeof(BackwardIndexHeader));
+    header.i_imagesPos = alignSectionPos(header.i_wordOffsetsPos
+                                         + (NB_VISUAL_WORDS + 1) * sizeof(u_int64_t));
+    u_int64_t i_endPos = header.i_imagesPos + header.i_nbImages * 2 * sizeof(u_int32_t);
+    if (buildForwardIndex)
+    {
+        header.i_forwardIndexPos = alignSectionPos(i_endPos);
+        i_endPos = header.i_forwardIndexPos + header.i_nbHits * sizeof(u_int32_t);
+    }
+    header.i_hitsPos = alignSectionPos(i_endPos);
 
-    cout << "Writing the index hits." << endl;
+    ofs.write((char *)&header, sizeof(BackwardIndexHeader));
+
+    cout << "Writing the word offsets." << endl;
+    writePadding(ofs, header.i_wordOffsetsPos);
+    u_int64_t i_wordOffset = 0;
+    vector<Hit> wordHits;
     for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
     {
-        const vector<Hit> &wordHits = indexHits[i];
+        ofs.write((char *)&i_wordOffset, sizeof(u_int64_t));
 
-        for (unsigned j = 0; j < wordHits.size(); ++j)
+        /* The dead hits and the ones of the images being added are not written
+         * so nbOccurences can not be used. */
+        wordHits.clear();
+        getLiveWordHits(*epoch, i, wordHits);
+        i_wordOffset += wordHits.size();
+    }
+    ofs.write((char *)&i_wordOffset, sizeof(u_int64_t));
+    assert(i_wordOffset == totalNbRecords);
+
+    // The live slots are written in order without the free and removed ones.
+    cout << "Writing the number of words per image." << endl;
+    writePadding(ofs, header.i_imagesPos);
+    vector<u_int32_t> fileSlots(slotStates.size());
+    u_int32_t i_fileSlot = 0;
+    for (u_int32_t i_slot = 0; i_slot < slotStates.size(); ++i_slot)
+    {
+        if (slotStates[i_slot] != SLOT_LIVE)
+            continue;
+        fileSlots[i_slot] = i_fileSlot++;
+
+        u_int32_t i_imageId = epoch->slots->getSlot(i_slot).i_imageId;
+        u_int32_t i_nbWords = slotNbWords[i_slot];
+        ofs.write((char *)&i_imageId, sizeof(u_int32_t));
+        ofs.write((char *)&i_nbWords, sizeof(u_int32_t));
+    }
+
+    if (buildForwardIndex)
+    {
+        cout << "Writing the forward index." << endl;
+        writePadding(ofs, header.i_forwardIndexPos);
+        for (u_int32_t i_slot = 0; i_slot < slotStates.size(); ++i_slot)
         {
-            const Hit &hit = wordHits[j];
-            ofs.write((char *)(&hit.i_imageId), sizeof(u_int32_t));
-            ofs.write((char *)(&hit.i_angle), sizeof(u_int16_t));
-            ofs.write((char *)(&hit.x), sizeof(u_int16_t));
-            ofs.write((char *)(&hit.y), sizeof(u_int16_t));
+            if (slotStates[i_slot] != SLOT_LIVE)
+                continue;
+            const vector<unsigned> &words = slotWords[i_slot];
+            assert(words.size() == slotNbWords[i_slot]);
+            ofs.write((char *)words.data(), words.size() * sizeof(u_int32_t));
         }
     }
 
+    cout << "Writing the index hits." << endl;
+    writePadding(ofs, header.i_hitsPos);
+    for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
+    {
+        wordHits.clear();
+        getLiveWordHits(*epoch, i, wordHits);
+        for (unsigned j = 0; j < wordHits.size(); ++j)
+            wordHits[j].i_imageId = fileSlots[wordHits[j].i_imageId];
+        ofs.write((char *)wordHits.data(), wordHits.size() * BACKWARD_INDEX_ENTRY_SIZE);
+    }
+
     ofs.close();
-    cout << "Writing done." << endl;
 
     pthread_rwlock_unlock(&rwLock);
 
+    if (!ofs.good() || rename(tmpIndexPath.c_str(), backwardIndexPath.c_str()) != 0)
+    {
+        cout << "Could not write the backward index file." << endl;
+        return INDEX_NOT_WRITTEN;
+    }
+    cout << "Writing done." << endl;
+
     return INDEX_WRITTEN;
 }
 
@@ -418,29 +1277,67 @@ u_int32_t ORBIndex::write(string backwardIndexPath)
  */
 u_int32_t ORBIndex::clear()
 {
+    pthread_mutex_lock(&mergeMutex);
+    pthread_mutex_lock(&writeMutex);
+    blockWriters();
     pthread_rwlock_wrlock(&rwLock);
+    reset();
+    publishEpoch(epoch);
+    pthread_rwlock_unlock(&rwLock);
+    unblockWriters();
+    pthread_mutex_unlock(&writeMutex);
+    pthread_mutex_unlock(&mergeMutex);
+
+    cout << "Index cleared." << endl;
+
+    return INDEX_CLEARED;
+}
+
+
+/**
+ * @brief Reset the index to an empty state.
+ * The hits are replaced by an empty epoch that must be published once
+ * the index is filled again. The previous epoch is freed once no search
+ * uses it anymore.
+ * The index write lock, the write mutex and the merge mutex MUST be held
+ * when calling this function.
+ */
+void ORBIndex::reset()
+{
     // Reset the nbOccurences table.
     for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
     {
         nbOccurences[i] = 0;
-        indexHits[i].clear();
+        wordMinNbWords[i] = UINT_MAX;
     }
 
-    nbWords.clear();
-    forwardIndex.clear();
-    tags.clear();
+    /* The new epoch is not published yet so that the searches keep using
+     * the previous one until the index is filled again. Its images are
+     * visible as soon as it is published. */
+    i_lastSeq = i_seq + 1;
+    i_seq.store(i_lastSeq, memory_order_release);
+    epoch = make_shared<IndexEpoch>(make_shared<BaseSegment>(), make_shared<DeltaSegment>(),
+                                    make_shared<SlotTable>(), i_seq);
+
+    i_nbDeltaHits = 0;
+    i_nbRemovedSlots = 0;
+    i_nbDeadHits = 0;
+
+    imageSlots.clear();
+    slotStates.clear();
+    slotNbWords.clear();
+    slotTags.clear();
+    slotWords.clear();
+    slotForwardHits.clear();
+    i_nbImages = 0;
 
     totalNbRecords = 0;
-    pthread_rwlock_unlock(&rwLock);
-
-    cout << "Index cleared." << endl;
-
-    return INDEX_CLEARED;
 }
 
 
 /**
  * @brief Load the index from a file.
+ * The hits are loaded in the base segment.
  * @param backwardIndexPath the path to the index file.
  * @return the operation code.
  */
@@ -449,91 +1346,456 @@ u_int32_t ORBIndex::load(string backwardIndexPath)
     u_int32_t i_ret;
 
     // Open the file.
-    BackwardIndexReaderFileAccess indexAccess;
-    if (!indexAccess.open(backwardIndexPath))
+    BackwardIndexReaderAccess *indexAccess;
+    if (mapIndexFile)
+        indexAccess = new BackwardIndexReaderMmapAccess();
+    else
+        indexAccess = new BackwardIndexReaderFileAccess();
+
+    if (!indexAccess->open(backwardIndexPath))
     {
         cout << "Could not open the backward index file." << endl;
+        delete indexAccess;
         i_ret = INDEX_NOT_FOUND;
     }
     else
     {
-        clear();
-
+        pthread_mutex_lock(&mergeMutex);
+        pthread_mutex_lock(&writeMutex);
+        blockWriters();
         pthread_rwlock_wrlock(&rwLock);
 
-        /* Read the table to know where are located the lines corresponding to each
-         * visual word. */
-        cout << "Reading the numbers of occurences." << endl;
-        u_int64_t *wordOffSet = new u_int64_t[NB_VISUAL_WORDS];
-        u_int64_t i_offset = NB_VISUAL_WORDS * sizeof(u_int64_t);
-        for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
+        reset();
+        if (mapIndexFile)
         {
-            indexAccess.read((char *)(nbOccurences + i), sizeof(u_int64_t));
-            wordOffSet[i] = i_offset;
-            i_offset += nbOccurences[i] * BACKWARD_INDEX_ENTRY_SIZE;
+            epoch->base->mappedIndex = (BackwardIndexReaderMmapAccess *)indexAccess;
+            mappedIndexPath = backwardIndexPath;
         }
 
-        /* Count the number of words per image. */
-        cout << "Counting the number of words per image." << endl;
-        totalNbRecords = 0;
-        while (true)
+        // Check if the file starts with a version 2 header.
+        BackwardIndexHeader header;
+        indexAccess->read((char *)&header, sizeof(BackwardIndexHeader));
+
+        bool b_loaded;
+        if (!indexAccess->endOfIndex()
+            && memcmp(header.magic, BACKWARD_INDEX_MAGIC, sizeof(header.magic)) == 0)
+            b_loaded = loadVersion2(backwardIndexPath, indexAccess, header);
+        else
         {
-            u_int32_t i_imageId;
-            u_int16_t i_angle, x, y;
-            indexAccess.read((char *)&i_imageId, sizeof(u_int32_t));
-            if (indexAccess.endOfIndex())
-                break;
-            indexAccess.read((char *)&i_angle, sizeof(u_int16_t));
-            indexAccess.read((char *)&x, sizeof(u_int16_t));
-            indexAccess.read((char *)&y, sizeof(u_int16_t));
-            nbWords[i_imageId]++;
-            totalNbRecords++;
+            indexAccess->reset();
+            indexAccess->moveAt(0);
+            b_loaded = loadVersion1(backwardIndexPath, indexAccess);
         }
 
-        indexAccess.reset();
-
-        cout << "Loading the index in memory." << endl;
+        if (!mapIndexFile)
+        {
+            indexAccess->close();
+            delete indexAccess;
+        }
 
-        for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+        if (b_loaded && compressImageIds)
         {
-            indexAccess.moveAt(wordOffSet[i_wordId]);
-            vector<Hit> &hits = indexHits[i_wordId];
+            BaseSegment &base = *epoch->base;
+            cout << "Compressing the image ids." << endl;
+            packBaseHits(base.offsets, base.hitsBuffer,
+                         base.packedOffsets, base.packedIds, base.payloads);
+            cout << "Image ids compressed from "
+                 << base.offsets[NB_VISUAL_WORDS] * sizeof(u_int32_t) / (1 << 20) << " MB to "
+                 << base.packedOffsets[NB_VISUAL_WORDS] / (1 << 20) << " MB." << endl;
+            delete[] base.hitsBuffer;
+            base.hitsBuffer = NULL;
+            base.hits = NULL;
+        }
 
-            const unsigned i_nbOccurences = nbOccurences[i_wordId];
-            hits.resize(i_nbOccurences);
+        if (b_loaded)
+        {
+            // The words are read in order so the forward hits are sorted.
+            vector<shared_ptr<ForwardHits> > forwardHits;
+            if (buildForwardHits)
+            {
+                cout << "Building the forward hits." << endl;
+                for (u_int32_t i_slot = 0; i_slot < slotNbWords.size(); ++i_slot)
+                {
+                    forwardHits.push_back(make_shared<ForwardHits>());
+                    forwardHits.back()->reserve(slotNbWords[i_slot]);
+                }
+            }
 
-            for (u_int64_t i = 0; i < i_nbOccurences; ++i)
+            vector<Hit> wordHits;
+            for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
             {
-                u_int32_t i_imageId;
-                u_int16_t i_angle, x, y;
-                indexAccess.read((char *)&i_imageId, sizeof(u_int32_t));
-                indexAccess.read((char *)&i_angle, sizeof(u_int16_t));
-                indexAccess.read((char *)&x, sizeof(u_int16_t));
-                indexAccess.read((char *)&y, sizeof(u_int16_t));
-                hits[i].i_imageId = i_imageId;
-                hits[i].i_angle = i_angle;
-                hits[i].x = x;
-                hits[i].y = y;
-
-                if (buildForwardIndex)
+                wordHits.clear();
+                getLiveWordHits(*epoch, i_wordId, wordHits);
+                wordMinNbWords[i_wordId] = getMinNbWords(wordHits);
+
+                for (unsigned i = 0; i < wordHits.size() && buildForwardHits; ++i)
                 {
-                    forwardIndex[i_imageId].push_back(i_wordId);
+                    ForwardHit forwardHit;
+                    forwardHit.i_wordId = i_wordId;
+                    forwardHit.i_angle = wordHits[i].i_angle;
+                    forwardHit.x = wordHits[i].x;
+                    forwardHit.y = wordHits[i].y;
+                    forwardHits[wordHits[i].i_imageId]->push_back(forwardHit);
                 }
             }
+
+            for (u_int32_t i_slot = 0; i_slot < forwardHits.size(); ++i_slot)
+                slotForwardHits[i_slot] = forwardHits[i_slot];
+            i_ret = INDEX_LOADED;
+        }
+        else
+        {
+            reset();
+            i_ret = INDEX_NOT_FOUND;
         }
 
-        indexAccess.close();
-        delete[] wordOffSet;
+        // The searches start to use the loaded index.
+        publishEpoch(epoch);
 
         pthread_rwlock_unlock(&rwLock);
-
-        i_ret = INDEX_LOADED;
+        unblockWriters();
+        pthread_mutex_unlock(&writeMutex);
+        pthread_mutex_unlock(&mergeMutex);
     }
 
     return i_ret;
 }
 
 
+/**
+ * @brief Load an index file of version 1.
+ * The file is made of the numbers of occurences of the words followed by
+ * the hits. The hits are loaded in memory to convert their image ids to slots
+ * even if the index file is mapped.
+ * @param backwardIndexPath the path to the index file.
+ * @param indexAccess the access to the index file.
+ * @return true on success else false.
+ * The index write lock MUST be held when calling this function.
+ */
+bool ORBIndex::loadVersion1(string backwardIndexPath,
+                            BackwardIndexReaderAccess *indexAccess)
+{
+    /* Read the table to know where are located the lines corresponding to each
+     * visual word. */
+    BaseSegment &base = *epoch->base;
+    cout << "Reading the numbers of occurences." << endl;
+    indexAccess->read((char *)base.offsets, NB_VISUAL_WORDS * sizeof(u_int64_t));
+
+    // Convert the numbers of occurences to offsets.
+    const u_int64_t i_hitsPos = NB_VISUAL_WORDS * sizeof(u_int64_t);
+    totalNbRecords = 0;
+    for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
+    {
+        nbOccurences[i] = base.offsets[i];
+        base.offsets[i] = totalNbRecords;
+        totalNbRecords += nbOccurences[i];
+    }
+    base.offsets[NB_VISUAL_WORDS] = totalNbRecords;
+
+    if (mapIndexFile)
+    {
+        cout << "The index file must be written again to be mapped." << endl;
+        delete base.mappedIndex;
+        base.mappedIndex = NULL;
+    }
+
+    unordered_map<u_int32_t, unsigned> imageNbWords;
+    if (!loadHits(backwardIndexPath, i_hitsPos, &imageNbWords))
+        return false;
+
+    // Give the slots in the order of the image ids.
+    vector<u_int32_t> imageIds;
+    imageIds.reserve(imageNbWords.size());
+    for (unordered_map<u_int32_t, unsigned>::const_iterator it = imageNbWords.begin();
+         it != imageNbWords.end(); ++it)
+        imageIds.push_back(it->first);
+    sort(imageIds.begin(), imageIds.end());
+    for (unsigned i = 0; i < imageIds.size(); ++i)
+        addSlot(imageIds[i], imageNbWords[imageIds[i]], epoch->i_baseSeq);
+
+    convertImageIdsToSlots();
+
+    if (buildForwardIndex)
+        buildForwardIndexFromHits();
+
+    return true;
+}
+
+
+/**
+ * @brief Load an index file of version 2 or 3.
+ * The sections are read in a single sequential pass. When a file of
+ * version 3 is memory mapped, the hit section is not read at all.
+ * @param backwardIndexPath the path to the index file.
+ * @param indexAccess the access to the index file.
+ * @param header the header of the file.
+ * @return true on success else false.
+ * The index write lock MUST be held when calling this function.
+ */
+bool ORBIndex::loadVersion2(string backwardIndexPath,
+                            BackwardIndexReaderAccess *indexAccess,
+                            const BackwardIndexHeader &header)
+{
+    if (header.i_version < 2 || header.i_version > BACKWARD_INDEX_VERSION
+        || header.i_nbWords != NB_VISUAL_WORDS)
+    {
+        cout << "Unsupported backward index file version." << endl;
+        return false;
+    }
+
+    // The word offsets of the file are the offsets of the base segment.
+    BaseSegment &base = *epoch->base;
+    cout << "Reading the word offsets." << endl;
+    indexAccess->moveAt(header.i_wordOffsetsPos);
+    indexAccess->read((char *)base.offsets, (NB_VISUAL_WORDS + 1) * sizeof(u_int64_t));
+    if (base.offsets[NB_VISUAL_WORDS] != header.i_nbHits)
+    {
+        cout << "The backward index file is corrupted." << endl;
+        return false;
+    }
+
+    for (unsigned i = 0; i < NB_VISUAL_WORDS; ++i)
+        nbOccurences[i] = base.offsets[i + 1] - base.offsets[i];
+    totalNbRecords = header.i_nbHits;
+
+    // The images get the slots of their order in the file.
+    cout << "Reading the number of words per image." << endl;
+    vector<u_int32_t> images(header.i_nbImages * 2);
+    indexAccess->moveAt(header.i_imagesPos);
+    indexAccess->read((char *)images.data(), images.size() * sizeof(u_int32_t));
+    imageSlots.rehash(header.i_nbImages);
+    for (u_int64_t i = 0; i < header.i_nbImages; ++i)
+        addSlot(images[2 * i], images[2 * i + 1], epoch->i_baseSeq);
+
+    const bool b_hasForwardIndex = header.i_flags & BACKWARD_INDEX_FLAG_FORWARD_INDEX;
+    if (buildForwardIndex && b_hasForwardIndex)
+    {
+        cout << "Reading the forward index." << endl;
+        indexAccess->moveAt(header.i_forwardIndexPos);
+        for (u_int64_t i = 0; i < header.i_nbImages; ++i)
+        {
+            vector<unsigned> &words = slotWords[i];
+            words.resize(images[2 * i + 1]);
+            indexAccess->read((char *)words.data(), words.size() * sizeof(u_int32_t));
+        }
+    }
+
+    // The hits of the version 2 hold image ids that must be converted.
+    const bool b_hasSlots = header.i_version >= 3;
+    if (mapIndexFile && !b_hasSlots)
+    {
+        cout << "The index file must be written again to be mapped." << endl;
+        delete base.mappedIndex;
+        base.mappedIndex = NULL;
+    }
+
+    if (base.mappedIndex != NULL)
+    {
+        if (base.mappedIndex->getSize() < header.i_hitsPos
+                                     + header.i_nbHits * BACKWARD_INDEX_ENTRY_SIZE)
+        {
+            cout << "The backward index file is truncated." << endl;
+            return false;
+        }
+
+        cout << "Mapping the index in memory." << endl;
+        base.hits = (const Hit *)base.mappedIndex->getData(header.i_hitsPos);
+    }
+    else if (!loadHits(backwardIndexPath, header.i_hitsPos, NULL))
+        return false;
+
+    if (!b_hasSlots)
+        convertImageIdsToSlots();
+
+    // Rebuild the forward index if it was not saved in the file.
+    if (buildForwardIndex && !b_hasForwardIndex)
+        buildForwardIndexFromHits();
+
+    return true;
+}
+
+
+/**
+ * @brief The IndexLoadingThread class
+ * This thread loads in memory the hits of a range of visual words and
+ * optionally counts the number of words of each image it reads.
+ */
+class IndexLoadingThread : public Thread
+{
+public:
+    IndexLoadingThread(string indexPath, u_int64_t i_startPos,
+                       Hit *p_hits, u_int64_t i_nbHits,
+                       bool countNbWords, atomic<u_int64_t> &i_nbLoadedBytes,
+                       atomic<unsigned> &i_nbFinishedThreads)
+        : indexPath(indexPath), i_startPos(i_startPos),
+          p_hits(p_hits), i_nbHits(i_nbHits),
+          countNbWords(countNbWords), i_nbLoadedBytes(i_nbLoadedBytes),
+          i_nbFinishedThreads(i_nbFinishedThreads), b_success(false) { }
+
+    void *run()
+    {
+        BackwardIndexReaderFileAccess indexAccess;
+        if (indexAccess.open(indexPath))
+        {
+            indexAccess.moveAt(i_startPos);
+
+            // The hits of the word range are contiguous in the file and in memory.
+            const u_int64_t i_nbBytes = i_nbHits * BACKWARD_INDEX_ENTRY_SIZE;
+            for (u_int64_t i = 0; i < i_nbBytes; i += INDEX_LOADING_CHUNK_SIZE)
+            {
+                const unsigned i_chunkSize = min(i_nbBytes - i, (u_int64_t)INDEX_LOADING_CHUNK_SIZE);
+                indexAccess.read((char *)p_hits + i, i_chunkSize);
+                i_nbLoadedBytes += i_chunkSize;
+            }
+
+            b_success = !indexAccess.endOfIndex();
+            indexAccess.close();
+
+            if (b_success && countNbWords)
+                for (const Hit *it = p_hits; it != p_hits + i_nbHits; ++it)
+                    nbWords[it->i_imageId]++;
+        }
+
+        i_nbFinishedThreads++;
+        return NULL;
+    }
+
+    string indexPath;
+    u_int64_t i_startPos;
+    Hit *p_hits;
+    u_int64_t i_nbHits;
+    bool countNbWords;
+    atomic<u_int64_t> &i_nbLoadedBytes;
+    atomic<unsigned> &i_nbFinishedThreads;
+
+    bool b_success;
+    unordered_map<u_int32_t, unsigned> nbWords; // key: image id, value: number of words.
+};
+
+
+/**
+ * @brief Load the hits of the index in the base segment with several threads.
+ * The word id range is split into slices of the same number of hits
+ * that are read concurrently.
+ * @param backwardIndexPath the path to the index file.
+ * @param i_hitsPos the position of the first hit in the file.
+ * @param imageNbWords the returned number of words per image id or NULL if
+ * they must not be counted.
+ * @return true on success else false.
+ * The base offsets must be filled and the index write lock MUST be held when
+ * calling this function.
+ */
+bool ORBIndex::loadHits(string backwardIndexPath, u_int64_t i_hitsPos,
+                        unordered_map<u_int32_t, unsigned> *imageNbWords)
+{
+    unsigned i_nbThreads = i_nbLoadingThreads;
+    if (i_nbThreads == 0)
+        i_nbThreads = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+    BaseSegment &base = *epoch->base;
+    base.hitsBuffer = new Hit[totalNbRecords];
+    base.hits = base.hitsBuffer;
+
+    const u_int64_t i_totalNbBytes = totalNbRecords * BACKWARD_INDEX_ENTRY_SIZE;
+    cout << "Loading the index in memory with " << i_nbThreads << " threads." << endl;
+
+    timeval t[2];
+    gettimeofday(&t[0], NULL);
+
+    // Split the words so that all the threads have the same amount of data to read.
+    atomic<u_int64_t> i_nbLoadedBytes(0);
+    atomic<unsigned> i_nbFinishedThreads(0);
+    vector<IndexLoadingThread *> threads;
+
+    unsigned i_wordId = 0;
+    for (unsigned i = 0; i < i_nbThreads; ++i)
+    {
+        const u_int64_t i_sliceEnd = totalNbRecords * (i + 1) / i_nbThreads;
+        const unsigned i_firstWordId = i_wordId;
+        while (i_wordId < NB_VISUAL_WORDS
+               && (base.offsets[i_wordId] < i_sliceEnd || i == i_nbThreads - 1))
+            i_wordId++;
+
+        const u_int64_t i_firstHit = base.offsets[i_firstWordId];
+        threads.push_back(new IndexLoadingThread(backwardIndexPath,
+            i_hitsPos + i_firstHit * BACKWARD_INDEX_ENTRY_SIZE,
+            base.hitsBuffer + i_firstHit, base.offsets[i_wordId] - i_firstHit,
+            imageNbWords != NULL, i_nbLoadedBytes, i_nbFinishedThreads));
+        threads.back()->start();
+    }
+
+    // Report the progress until all the threads are done.
+    unsigned i_nbPolls = 0;
+    while (i_nbFinishedThreads < i_nbThreads)
+    {
+        usleep(10000);
+        if (++i_nbPolls % 100 == 0 && i_totalNbBytes > 0)
+            cout << "Loaded " << i_nbLoadedBytes / (1 << 20) << " MB / "
+                 << i_totalNbBytes / (1 << 20) << " MB ("
+                 << 100 * i_nbLoadedBytes / i_totalNbBytes << "%)." << endl;
+    }
+
+    bool b_ret = true;
+    for (unsigned i = 0; i < threads.size(); ++i)
+    {
+        threads[i]->join();
+        b_ret &= threads[i]->b_success;
+
+        // Merge the number of words per image.
+        for (unordered_map<u_int32_t, unsigned>::const_iterator it = threads[i]->nbWords.begin();
+             it != threads[i]->nbWords.end(); ++it)
+            (*imageNbWords)[it->first] += it->second;
+
+        delete threads[i];
+    }
+
+    gettimeofday(&t[1], NULL);
+    const double f_time = (t[1].tv_sec - t[0].tv_sec) + (t[1].tv_usec - t[0].tv_usec) / 1e6;
+
+    if (!b_ret)
+    {
+        cout << "The backward index file is truncated." << endl;
+        return false;
+    }
+
+    cout << "Index hits loaded in " << f_time << " s ("
+         << i_totalNbBytes / f_time / (1 << 30) << " GB/s)." << endl;
+
+    return true;
+}
+
+
+/**
+ * @brief Convert the image ids of the hits loaded from a file to slots.
+ * The index write lock MUST be held when calling this function.
+ */
+void ORBIndex::convertImageIdsToSlots()
+{
+    cout << "Converting the image ids to slots." << endl;
+    Hit *hits = epoch->base->hitsBuffer;
+    for (u_int64_t i = 0; i < totalNbRecords; ++i)
+        hits[i].i_imageId = imageSlots[hits[i].i_imageId];
+}
+
+
+/**
+ * @brief Build the forward index from the hits of the backward index.
+ * The index write lock MUST be held when calling this function.
+ */
+void ORBIndex::buildForwardIndexFromHits()
+{
+    cout << "Building the forward index." << endl;
+    vector<Hit> hits;
+    for (unsigned i_wordId = 0; i_wordId < NB_VISUAL_WORDS; ++i_wordId)
+    {
+        hits.clear();
+        getWordHits(*epoch, i_wordId).getHits(hits);
+        for (vector<Hit>::const_iterator it = hits.begin(); it != hits.end(); ++it)
+            slotWords[it->i_imageId].push_back(i_wordId);
+    }
+}
+
+
 /**
  * @brief Load the index tags from a file.
  * @param indexTagsPath the path to the index tags file.
@@ -555,7 +1817,8 @@ u_int32_t ORBIndex::loadTags(string indexTagsPath)
 
     pthread_rwlock_wrlock(&rwLock);
 
-    tags.clear();
+    for (unsigned i = 0; i < slotTags.size(); ++i)
+        slotTags[i].clear();
     while (true)
     {
         // Read the image tag.
@@ -570,8 +1833,11 @@ u_int32_t ORBIndex::loadTags(string indexTagsPath)
 
         cout << i_imageId << " " << i_tagSize << " " << psz_tag << endl;
 
-        // Save it into the memory.
-        tags[i_imageId] = string(psz_tag);
+        // Save it into the memory if the image is in the index.
+        unordered_map<u_int32_t, u_int32_t>::const_iterator slotIt =
+            imageSlots.find(i_imageId);
+        if (slotIt != imageSlots.end())
+            slotTags[slotIt->second] = string(psz_tag);
     }
 
     pthread_rwlock_unlock(&rwLock);
@@ -603,11 +1869,13 @@ u_int32_t ORBIndex::writeTags(string indexTagsPath)
 
     cout << "Writing the index image tags." << endl;
 
-    for (unordered_map<u_int32_t, string>::const_iterator it = tags.begin();
-         it != tags.end(); ++it)
+    for (u_int32_t i_slot = 0; i_slot < slotTags.size(); ++i_slot)
     {
-        u_int32_t i_imageId = it->first;
-        const char *psz_tag = it->second.c_str();
+        if (slotStates[i_slot] != SLOT_LIVE || slotTags[i_slot].empty())
+            continue;
+
+        u_int32_t i_imageId = epoch->slots->getSlot(i_slot).i_imageId;
+        const char *psz_tag = slotTags[i_slot].c_str();
         u_int32_t i_tagSize = strlen(psz_tag) + 1;
 
         ofs.write((char *)(&i_imageId), sizeof(u_int32_t));
@@ -633,28 +1901,10 @@ u_int32_t ORBIndex::writeTags(string indexTagsPath)
  */
 u_int32_t ORBIndex::getImageIds(vector<u_int32_t> &imageIds)
 {
-    imageIds.reserve(nbWords.size());
-    for (unordered_map<u_int64_t, unsigned>::const_iterator it = nbWords.begin();
-         it != nbWords.end(); ++it)
+    imageIds.reserve(imageSlots.size());
+    for (unordered_map<u_int32_t, u_int32_t>::const_iterator it = imageSlots.begin();
+         it != imageSlots.end(); ++it)
         imageIds.push_back(it->first);
 
     return INDEX_IMAGE_IDS;
 }
-
-
-/**
- * @brief Lock for reading the index.
- */
-void ORBIndex::readLock()
-{
-    pthread_rwlock_rdlock(&rwLock);
-}
-
-
-/**
- * @brief Unlock the index.
- */
-void ORBIndex::unlock()
-{
-    pthread_rwlock_unlock(&rwLock);
-}
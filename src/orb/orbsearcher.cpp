@@ -45,62 +45,145 @@
 using namespace std::tr1;
 #endif
 
-ORBSearcher::ORBSearcher(ORBIndex *index, ORBWordIndex *wordIndex)
-    : index(index), wordIndex(wordIndex), orb(ORB::create(2000, 1.02, 100))
-{ }
+ORBSearcher::ORBSearcher(ORBIndex *index, ORBWordIndex *wordIndex, ThreadPool *threadPool,
+                         bool prunedRanking, bool checkPrunedRanking, bool checkVerification,
+                         bool prosacSampling, bool adaptiveRansac, bool poseVoting)
+    : index(index), wordIndex(wordIndex), threadPool(threadPool),
+      reranker(threadPool, checkVerification, prosacSampling, adaptiveRansac,
+               poseVoting),
+      orb(ORB::create(2000, 1.02, 100)), prunedRanking(prunedRanking),
+      checkPrunedRanking(checkPrunedRanking), prosacSampling(prosacSampling)
+{
+    pthread_mutex_init(&accumulatorsMutex, NULL);
+}
 
 
 ORBSearcher::~ORBSearcher()
-{ }
+{
+    for (unsigned i = 0; i < freeAccumulators.size(); ++i)
+        delete freeAccumulators[i];
+    pthread_mutex_destroy(&accumulatorsMutex);
+}
+
+
+/**
+ * @brief Get a score accumulator from the ones of the previous requests.
+ * @return the empty accumulator.
+ */
+ScoreAccumulator *ORBSearcher::acquireAccumulator()
+{
+    ScoreAccumulator *acc = NULL;
+    pthread_mutex_lock(&accumulatorsMutex);
+    if (!freeAccumulators.empty())
+    {
+        acc = freeAccumulators.back();
+        freeAccumulators.pop_back();
+    }
+    pthread_mutex_unlock(&accumulatorsMutex);
+
+    return acc != NULL ? acc : new ScoreAccumulator();
+}
+
+
+/**
+ * @brief Give back an empty score accumulator for the next requests.
+ * @param acc the accumulator.
+ */
+void ORBSearcher::releaseAccumulator(ScoreAccumulator *acc)
+{
+    pthread_mutex_lock(&accumulatorsMutex);
+    freeAccumulators.push_back(acc);
+    pthread_mutex_unlock(&accumulatorsMutex);
+}
 
 
 /**
- * @brief The RankingThread class
- * This threads computes the tf-idf weights of the images that contains the words
- * given in argument.
+ * @brief The RankingTask class
+ * This task computes the tf-idf weights of the images that contains the words
+ * given in argument. If a candidate accumulator is given, only the weights of
+ * the slots touched in it are computed.
  */
-class RankingThread : public Thread
+class RankingTask : public PoolTask
 {
 public:
-    RankingThread(ORBIndex *index, const unsigned i_nbTotalIndexedImages,
-                  std::unordered_map<u_int32_t, vector<Hit> > &indexHits)
-        : index(index), i_nbTotalIndexedImages(i_nbTotalIndexedImages),
-          indexHits(indexHits) { }
+    RankingTask(const IndexSnapshot &snapshot,
+                std::unordered_map<u_int32_t, WordHits> &indexHits,
+                const std::unordered_map<u_int32_t, float> &wordWeights,
+                ScoreAccumulator &weights, const ScoreAccumulator *candidates)
+        : snapshot(snapshot), indexHits(indexHits), wordWeights(wordWeights),
+          weights(weights), candidates(candidates) { }
 
     void addWord(u_int32_t i_wordId)
     {
         wordIds.push_back(i_wordId);
     }
 
-    void *run()
+    void run()
     {
-        weights.rehash(wordIds.size());
-
         for (deque<u_int32_t>::const_iterator it = wordIds.begin();
             it != wordIds.end(); ++it)
+            scoreWord(*it);
+    }
+
+    void scoreWord(u_int32_t i_wordId)
+    {
+        const WordHits &hits = indexHits[i_wordId];
+
+        const float f_weight = wordWeights.find(i_wordId)->second;
+
+        // Only the image ids are needed so the payloads are not read.
+        if (!hits.packedBase.empty())
         {
-            const vector<Hit> &hits = indexHits[*it];
-
-            const float f_weight = log((float)i_nbTotalIndexedImages / hits.size());
-
-            for (vector<Hit>::const_iterator it2 = hits.begin();
-                 it2 != hits.end(); ++it2)
-            {
-                /* TF-IDF according to the paper "Video Google:
-                 * A Text Retrieval Approach to Object Matching in Videos" */
-                unsigned i_totalNbWords = index->countTotalNbWord(it2->i_imageId);
-                weights[it2->i_imageId] += f_weight / i_totalNbWords;
-            }
+            imageIds.resize(hits.packedBase.size());
+            hits.packedBase.decodeImageIds(imageIds.data());
+            for (unsigned i = 0; i < imageIds.size(); ++i)
+                addWeight(imageIds[i], f_weight);
         }
 
-        return NULL;
+        for (unsigned i = 0; i < NB_HIT_SEGMENTS; ++i)
+        {
+            const HitSpan &segment = hits.segments[i];
+            for (const Hit *it2 = segment.begin(); it2 != segment.end(); ++it2)
+                addWeight(it2->i_imageId, f_weight);
+        }
     }
 
-    ORBIndex *index;
-    const unsigned i_nbTotalIndexedImages;
-    std::unordered_map<u_int32_t, vector<Hit> > &indexHits;
+    void addWeight(u_int32_t i_slot, float f_weight)
+    {
+        if (candidates != NULL && !candidates->isTouched(i_slot))
+            return;
+
+        // Skip the hits of the images that are not in the snapshot.
+        if (!snapshot.isSlotVisible(i_slot))
+            return;
+
+        /* TF-IDF according to the paper "Video Google:
+         * A Text Retrieval Approach to Object Matching in Videos" */
+        weights.add(i_slot, f_weight * snapshot.getSlotInvNbWords(i_slot));
+    }
+
+    const IndexSnapshot &snapshot;
+    std::unordered_map<u_int32_t, WordHits> &indexHits;
+    const std::unordered_map<u_int32_t, float> &wordWeights;
     deque<u_int32_t> wordIds;
-    std::unordered_map<u_int32_t, float> weights; // key: image id, value: image score.
+    ScoreAccumulator &weights; // The scores of the images by slot.
+    const ScoreAccumulator *candidates;
+    vector<u_int32_t> imageIds; // Decoding buffer of the compressed image slots.
+};
+
+
+/**
+ * @brief The upper bound of the contribution of a word to the image scores.
+ */
+struct WordBound
+{
+    u_int32_t i_wordId;
+    float f_maxWeight;
+
+    bool operator< (const WordBound &bound) const
+    {
+        return f_maxWeight > bound.f_maxWeight;
+    }
 };
 
 
@@ -137,40 +220,59 @@ u_int32_t ORBSearcher::searchImage(SearchRequest &request)
                                        : i_nbTotalIndexedImages;
 
     std::unordered_map<u_int32_t, list<Hit> > imageReqHits; // key: visual word, value: the found angles
+    // key: visual word, value: the distance of the descriptor of its hit to the word.
+    std::unordered_map<u_int32_t, unsigned> wordDistances;
+    // key: visual word, value: the weight of the probe of its hit.
+    std::unordered_map<u_int32_t, float> probeWeights;
+    const unsigned i_nbProbes = request.i_nbProbes;
     for (unsigned i = 0; i < keypoints.size(); ++i)
     {
-        #define NB_NEIGHBORS 1
-
-        vector<int> indices(NB_NEIGHBORS);
-        vector<int> dists(NB_NEIGHBORS);
+        /* Each descriptor is assigned to its i_nbProbes nearest words. The
+         * farther words get a lower weight so that the words that the
+         * descriptor could have been assigned to in the index still match. */
+        vector<int> indices(i_nbProbes, -1);
+        vector<int> dists(i_nbProbes);
         wordIndex->knnSearch(descriptors.row(i), indices,
-                           dists, NB_NEIGHBORS);
+                           dists, i_nbProbes);
 
         for (unsigned j = 0; j < indices.size(); ++j)
         {
+            if (indices[j] < 0)
+                break; // Less words than probes were found.
+
             const unsigned i_wordId = indices[j];
+            const float f_probeWeight = getProbeWeight(dists[0], dists[j]);
+            if (f_probeWeight < MULTI_PROBE_MIN_WEIGHT)
+                break;
 
             if (index->getWordNbOccurences(i_wordId) > i_maxNbOccurences)
                 continue;
 
-            if (imageReqHits.find(i_wordId) == imageReqHits.end())
-            {
-                // Convert the angle to a 16 bit integer.
-                Hit hit;
-                hit.i_imageId = 0;
-                hit.i_angle = keypoints[i].angle / 360 * (1 << 16);
-                hit.x = keypoints[i].pt.x;
-                hit.y = keypoints[i].pt.y;
-
-                imageReqHits[i_wordId].push_back(hit);
-            }
+            /* A word probed by several descriptors keeps the hit of the
+             * closest one. */
+            std::unordered_map<u_int32_t, float>::iterator weightIt = probeWeights.find(i_wordId);
+            if (weightIt != probeWeights.end() && weightIt->second >= f_probeWeight)
+                continue;
+
+            // Convert the angle to a 16 bit integer.
+            Hit hit;
+            hit.i_imageId = 0;
+            hit.i_angle = keypoints[i].angle / 360 * (1 << 16);
+            hit.x = keypoints[i].pt.x;
+            hit.y = keypoints[i].pt.y;
+
+            list<Hit> &wordHits = imageReqHits[i_wordId];
+            wordHits.clear();
+            wordHits.push_back(hit);
+            wordDistances[i_wordId] = dists[j];
+            probeWeights[i_wordId] = f_probeWeight;
         }
     }
 
     gettimeofday(&t[2], NULL);
     cout << "time: " << getTimeDiff(t[1], t[2]) << " ms." << endl;
 
-    return processSimilar(request, imageReqHits);
+    return processSimilar(request, imageReqHits, wordDistances, probeWeights);
 }
 
 
@@ -195,14 +297,96 @@ u_int32_t ORBSearcher::searchSimilar(SearchRequest &request)
     gettimeofday(&t[1], NULL);
     cout << "time: " << getTimeDiff(t[0], t[1]) << " ms." << endl;
 
-    return processSimilar(request, imageReqHits);
+    // The hits come from the index so their descriptors are not known.
+    return processSimilar(request, imageReqHits, std::unordered_map<u_int32_t, unsigned>(),
+                          std::unordered_map<u_int32_t, float>());
+}
+
+
+/**
+ * @brief Return the weight of a word probed by a descriptor, relative to the
+ * nearest word of the descriptor, from a Gaussian of the Hamming distances.
+ * @param i_nearestDist the distance of the descriptor to its nearest word.
+ * @param i_dist the distance of the descriptor to the word.
+ * @return the weight, 1 for the nearest word.
+ */
+float ORBSearcher::getProbeWeight(int i_nearestDist, int i_dist)
+{
+    return exp(-(float)(i_dist * i_dist - i_nearestDist * i_nearestDist)
+               / (2 * MULTI_PROBE_SIGMA * MULTI_PROBE_SIGMA));
+}
+
+
+/**
+ * @brief Compute the tf-idf weight of each word of the request: its idf
+ * multiplied by the weight of its probe.
+ * @param indexHits the hits of the words of the request.
+ * @param probeWeights the weights of the probes of the words or an empty
+ * map if all the words are the nearest ones of their descriptor.
+ * @param i_nbTotalIndexedImages the number of images of the index.
+ * @param wordWeights the weights of the words, 0 for the ones without hits.
+ */
+void ORBSearcher::getWordWeights(std::unordered_map<u_int32_t, WordHits> &indexHits,
+                                 const std::unordered_map<u_int32_t, float> &probeWeights,
+                                 unsigned i_nbTotalIndexedImages,
+                                 std::unordered_map<u_int32_t, float> &wordWeights)
+{
+    wordWeights.rehash(indexHits.size());
+    for (std::unordered_map<u_int32_t, WordHits>::const_iterator it = indexHits.begin();
+         it != indexHits.end(); ++it)
+    {
+        if (it->second.size() == 0)
+        {
+            wordWeights[it->first] = 0;
+            continue;
+        }
+
+        float f_weight = log((float)i_nbTotalIndexedImages / it->second.size());
+        std::unordered_map<u_int32_t, float>::const_iterator probeIt = probeWeights.find(it->first);
+        if (probeIt != probeWeights.end())
+            f_weight *= probeIt->second;
+        wordWeights[it->first] = f_weight;
+    }
+}
+
+
+/**
+ * @brief Compute the quality of the correspondences of each word of the
+ * request for the PROSAC sampling of the reranking: the idf of the word
+ * lowered by the Hamming distance of the descriptor of the request to the word.
+ * @param indexHits the hits of the words of the request.
+ * @param wordDistances the distances of the descriptors of the request to
+ * their word or an empty map if they are not known.
+ * @param i_nbTotalIndexedImages the number of images of the index.
+ * @param wordQualities the qualities of the words.
+ */
+void ORBSearcher::getWordQualities(std::unordered_map<u_int32_t, WordHits> &indexHits,
+                                   const std::unordered_map<u_int32_t, unsigned> &wordDistances,
+                                   unsigned i_nbTotalIndexedImages,
+                                   std::unordered_map<u_int32_t, float> &wordQualities)
+{
+    wordQualities.rehash(indexHits.size());
+    for (std::unordered_map<u_int32_t, WordHits>::const_iterator it = indexHits.begin();
+         it != indexHits.end(); ++it)
+    {
+        if (it->second.size() == 0)
+            continue;
+
+        float f_quality = log((float)i_nbTotalIndexedImages / it->second.size());
+        std::unordered_map<u_int32_t, unsigned>::const_iterator distIt = wordDistances.find(it->first);
+        if (distIt != wordDistances.end())
+            f_quality *= 1 - (float)distIt->second / ORB_DESCRIPTOR_NB_BITS;
+        wordQualities[it->first] = f_quality;
+    }
 }
 
 
 u_int32_t ORBSearcher::processSimilar(SearchRequest &request,
-        std::unordered_map<u_int32_t, list<Hit> > imageReqHits)
+        std::unordered_map<u_int32_t, list<Hit> > imageReqHits,
+        const std::unordered_map<u_int32_t, unsigned> &wordDistances,
+        const std::unordered_map<u_int32_t, float> &probeWeights)
 {
-    timeval t[7];
+    timeval t[5];
     gettimeofday(&t[0], NULL);
 
     const unsigned i_nbTotalIndexedImages = index->getTotalNbIndexedImages();
@@ -210,83 +394,303 @@ u_int32_t ORBSearcher::processSimilar(SearchRequest &request,
     cout << imageReqHits.size() << " visual words kept for the request." << endl;
     cout << i_nbTotalIndexedImages << " images indexed in the index." << endl;
 
-    std::unordered_map<u_int32_t, vector<Hit> > indexHits; // key: visual word id, values: index hits.
+    /* The index hits are not copied so the snapshot must be kept
+     * until the end of the reranking. */
+    IndexSnapshot snapshot;
+    index->getSnapshot(snapshot);
+
+    std::unordered_map<u_int32_t, WordHits> indexHits; // key: visual word id, values: index hits.
     indexHits.rehash(imageReqHits.size());
-    index->getImagesWithVisualWords(imageReqHits, indexHits);
+    index->getImagesWithVisualWords(snapshot, imageReqHits, indexHits);
 
     gettimeofday(&t[1], NULL);
     cout << "time: " << getTimeDiff(t[0], t[1]) << " ms." << endl;
     cout << "Ranking the images." << endl;
 
-    index->readLock();
-    #define NB_RANKING_THREAD 4
+    std::unordered_map<u_int32_t, float> wordWeights;
+    getWordWeights(indexHits, probeWeights, i_nbTotalIndexedImages, wordWeights);
 
-    // Map the ranking to threads.
-    unsigned i_wordsPerThread = indexHits.size() / NB_RANKING_THREAD + 1;
-    RankingThread *threads[NB_RANKING_THREAD];
+    // Without reranking, only the returned images are needed.
+    const unsigned i_nbFirstImages = request.b_geometricVerification
+                                     ? request.i_nbRerankedImages : request.i_maxNbResults;
 
-    std::unordered_map<u_int32_t, vector<Hit> >::const_iterator it = indexHits.begin();
-    for (unsigned i = 0; i < NB_RANKING_THREAD; ++i)
+    ScoreAccumulator *weights;
+    if (prunedRanking)
     {
-        threads[i] = new RankingThread(index, i_nbTotalIndexedImages, indexHits);
-
-        unsigned i_nbWords = 0;
-        for (; it != indexHits.end() && i_nbWords < i_wordsPerThread; ++it, ++i_nbWords)
-            threads[i]->addWord(it->first);
+        weights = rankImagesPruned(snapshot, indexHits, wordWeights, i_nbFirstImages);
+        if (checkPrunedRanking)
+            checkRanking(snapshot, indexHits, wordWeights, *weights, i_nbFirstImages);
+    }
+    else
+    {
+        vector<u_int32_t> wordIds;
+        for (std::unordered_map<u_int32_t, WordHits>::const_iterator it = indexHits.begin();
+             it != indexHits.end(); ++it)
+            wordIds.push_back(it->first);
+        weights = rankImages(snapshot, indexHits, wordWeights, wordIds, NULL);
     }
 
     gettimeofday(&t[2], NULL);
-    cout << "init threads time: " << getTimeDiff(t[1], t[2]) << " ms." << endl;
+    cout << "ranking time: " << getTimeDiff(t[1], t[2]) << " ms." << endl;
 
-    // Compute
-    for (unsigned i = 0; i < NB_RANKING_THREAD; ++i)
-        threads[i]->start();
-    for (unsigned i = 0; i < NB_RANKING_THREAD; ++i)
-        threads[i]->join();
+    // Only the first slots of the images that share words with the request are reranked.
+    vector<SearchResult> rankedResults;
+    const unsigned i_nbRankedImages = weights->getFirstResults(i_nbFirstImages, rankedResults);
+    weights->reset();
+    releaseAccumulator(weights);
 
     gettimeofday(&t[3], NULL);
-    cout << "compute time: " << getTimeDiff(t[2], t[3]) << " ms." << endl;
+    cout << "rankedResult time: " << getTimeDiff(t[2], t[3]) << " ms." << endl;
+
+    if (!request.b_geometricVerification)
+    {
+        cout << "Returning the first " << rankedResults.size() << " images of the ranking." << endl;
+        priority_queue<SearchResult> results;
+        for (unsigned i = 0; i < rankedResults.size(); ++i)
+        {
+            SearchResult res = rankedResults[i];
+            res.i_imageId = snapshot.getSlotImageId(res.i_imageId);
+            results.push(res);
+        }
+        returnResults(results, request, request.i_maxNbResults);
 
-    // Reduce...
-    std::unordered_map<u_int32_t, float> weights; // key: image id, value: image score.
-    weights.rehash(i_nbTotalIndexedImages);
-    for (unsigned i = 0; i < NB_RANKING_THREAD; ++i)
-        for (std::unordered_map<u_int32_t, float>::const_iterator it = threads[i]->weights.begin();
-            it != threads[i]->weights.end(); ++it)
-            weights[it->first] += it->second;
+        return SEARCH_RESULTS;
+    }
+
+    if (request.b_adaptiveDepth)
+        rankedResults.resize(getRerankingDepth(rankedResults), SearchResult(0, 0, Rect()));
+    cout << "Reranking " << rankedResults.size() << " among " << i_nbRankedImages << " images." << endl;
+
+    /* The correspondences are read from the forward hits of the images if the
+     * index keeps them instead of scanning the posting lists again. */
+    vector<u_int32_t> candidateSlots;
+    for (unsigned i = 0; i < rankedResults.size(); ++i)
+        candidateSlots.push_back(rankedResults[i].i_imageId);
+    vector<shared_ptr<const ForwardHits> > forwardHits;
+    index->getSlotForwardHits(snapshot, candidateSlots, forwardHits);
+
+    std::unordered_map<u_int32_t, float> wordQualities;
+    if (prosacSampling)
+        getWordQualities(indexHits, wordDistances, i_nbTotalIndexedImages, wordQualities);
+
+    priority_queue<SearchResult> rerankedResults;
+    reranker.rerank(imageReqHits, indexHits, rankedResults, forwardHits, wordQualities,
+                    request.b_firstMatch ? request.i_firstMatchMinScore : 0, rerankedResults);
+
+    // The results hold image slots that must be converted to image ids.
+    priority_queue<SearchResult> results;
+    while (!rerankedResults.empty())
+    {
+        SearchResult res = rerankedResults.top();
+        res.i_imageId = snapshot.getSlotImageId(res.i_imageId);
+        results.push(res);
+        rerankedResults.pop();
+    }
 
     gettimeofday(&t[4], NULL);
-    cout << "reduce time: " << getTimeDiff(t[3], t[4]) << " ms." << endl;
+    cout << "time: " << getTimeDiff(t[3], t[4]) << " ms." << endl;
+    cout << "Returning the results. " << endl;
+
+    /* In the first match mode, the best verified image is the match if one
+     * was found, else the best image of the complete verification. */
+    returnResults(results, request, request.b_firstMatch ? 1 : request.i_maxNbResults);
+
+    return SEARCH_RESULTS;
+}
+
+
+/**
+ * @brief Compute the tf-idf scores of the images for some words of the request.
+ * The words are split between NB_RANKING_TASKS tasks of the thread pool.
+ * @param snapshot the snapshot of the index.
+ * @param indexHits the hits of the words of the request.
+ * @param wordWeights the tf-idf weights of the words of the request.
+ * @param wordIds the words to score.
+ * @param candidates if not NULL, only the slots touched in this accumulator are scored.
+ * @return the accumulator of the scores, to release once used.
+ */
+ScoreAccumulator *ORBSearcher::rankImages(const IndexSnapshot &snapshot,
+                                          std::unordered_map<u_int32_t, WordHits> &indexHits,
+                                          const std::unordered_map<u_int32_t, float> &wordWeights,
+                                          const vector<u_int32_t> &wordIds,
+                                          const ScoreAccumulator *candidates)
+{
+    // Map the ranking to tasks.
+    unsigned i_wordsPerTask = wordIds.size() / NB_RANKING_TASKS + 1;
+    RankingTask *tasks[NB_RANKING_TASKS];
+    ScoreAccumulator *accumulators[NB_RANKING_TASKS];
+
+    const u_int32_t i_nbSlots = snapshot.getNbSlots();
+    vector<u_int32_t>::const_iterator it = wordIds.begin();
+    for (unsigned i = 0; i < NB_RANKING_TASKS; ++i)
+    {
+        accumulators[i] = acquireAccumulator();
+        accumulators[i]->resize(i_nbSlots);
+        tasks[i] = new RankingTask(snapshot, indexHits, wordWeights,
+                                   *accumulators[i], candidates);
+
+        unsigned i_nbWords = 0;
+        for (; it != wordIds.end() && i_nbWords < i_wordsPerTask; ++it, ++i_nbWords)
+            tasks[i]->addWord(*it);
+    }
+
+    // Compute
+    TaskGroup rankingTasks;
+    for (unsigned i = 0; i < NB_RANKING_TASKS; ++i)
+        threadPool->submit(tasks[i], rankingTasks);
+    rankingTasks.wait();
+
+    // Reduce in the accumulator of the first task.
+    for (unsigned i = 1; i < NB_RANKING_TASKS; ++i)
+    {
+        accumulators[0]->reduce(*accumulators[i]);
+        releaseAccumulator(accumulators[i]);
+    }
 
     // Free the memory
-    for (unsigned i = 0; i < NB_RANKING_THREAD; ++i)
-        delete threads[i];
+    for (unsigned i = 0; i < NB_RANKING_TASKS; ++i)
+        delete tasks[i];
+
+    return accumulators[0];
+}
+
+
+/**
+ * @brief Compute the tf-idf scores of the images that can be in the first
+ * results, in the MaxScore style.
+ * The contribution of a word to the score of an image is bounded by its idf
+ * divided by the smallest number of words of its images. The words are
+ * scored by decreasing bound. Once the sum of the bounds of the remaining
+ * words is lower than the k-th score, the images that do not have this
+ * score minus the remaining bounds cannot be in the first k results: the
+ * remaining words are only scored for the other images. The first k images
+ * and their scores are then the same as the ones of the exhaustive ranking.
+ * @param snapshot the snapshot of the index.
+ * @param indexHits the hits of the words of the request.
+ * @param wordWeights the tf-idf weights of the words of the request.
+ * @param k the number of results that must be exact.
+ * @return the accumulator of the scores, to release once used.
+ */
+ScoreAccumulator *ORBSearcher::rankImagesPruned(const IndexSnapshot &snapshot,
+                                                std::unordered_map<u_int32_t, WordHits> &indexHits,
+                                                const std::unordered_map<u_int32_t, float> &wordWeights,
+                                                unsigned k)
+{
+    vector<WordBound> bounds;
+    vector<u_int32_t> wordIds;
+    bool b_negativeWeights = false;
+    for (std::unordered_map<u_int32_t, WordHits>::const_iterator it = indexHits.begin();
+         it != indexHits.end(); ++it)
+    {
+        wordIds.push_back(it->first);
+        if (it->second.size() == 0)
+            continue;
+
+        WordBound bound;
+        bound.i_wordId = it->first;
+        const float f_weight = wordWeights.find(it->first)->second;
+        bound.f_maxWeight = f_weight / index->getWordMinNbWords(it->first);
+        bounds.push_back(bound);
+        b_negativeWeights |= f_weight < 0;
+    }
 
-    index->unlock();
+    // The scores only grow while the words are scored if all the weights are positive.
+    if (b_negativeWeights)
+        return rankImages(snapshot, indexHits, wordWeights, wordIds, NULL);
 
-    priority_queue<SearchResult> rankedResults;
-    for (std::unordered_map<unsigned, float>::const_iterator it = weights.begin();
-         it != weights.end(); ++it)
+    sort(bounds.begin(), bounds.end());
+
+    // The sums of the bounds of the words that follow each word.
+    vector<float> remainingBounds(bounds.size() + 1, 0);
+    for (unsigned i = bounds.size(); i > 0; --i)
+        remainingBounds[i - 1] = remainingBounds[i] + bounds[i - 1].f_maxWeight;
+
+    ScoreAccumulator *weights = acquireAccumulator();
+    weights->resize(snapshot.getNbSlots());
+    RankingTask headTask(snapshot, indexHits, wordWeights, *weights, NULL);
+
+    /* The words with the highest bounds have the shortest posting lists.
+     * They are scored until k images have a score higher than the remaining
+     * bounds, checking it each time the remaining bounds are lowered by a
+     * quarter. */
+    unsigned i = 0;
+    float f_lastCheck = remainingBounds[0];
+    while (i < bounds.size())
     {
-        //cout << "Second: " << it->second << " First: " << it->first << endl;
-        rankedResults.push(SearchResult(it->second, it->first, Rect()));
+        headTask.scoreWord(bounds[i++].i_wordId);
+        if (remainingBounds[i] <= f_lastCheck * 0.75f)
+        {
+            f_lastCheck = remainingBounds[i];
+            if (weights->countScoresAbove(remainingBounds[i], k) == k)
+                break;
+        }
     }
 
-    gettimeofday(&t[5], NULL);
-    cout << "rankedResult time: " << getTimeDiff(t[4], t[5]) << " ms." << endl;
-    cout << "Reranking 300 among " << rankedResults.size() << " images." << endl;
+    cout << i << " of the " << bounds.size() << " words scored for all the images." << endl;
 
-    priority_queue<SearchResult> rerankedResults;
-    reranker.rerank(imageReqHits, indexHits,
-                    rankedResults, rerankedResults, 300);
+    if (i < bounds.size())
+    {
+        // A small margin keeps the images whose bound is only lowered by the rounding.
+        const float f_kthScore = weights->getKthScore(k);
+        weights->prune((f_kthScore - remainingBounds[i]) * (1 - RANKING_PRUNING_MARGIN));
+
+        vector<u_int32_t> tailWordIds;
+        for (; i < bounds.size(); ++i)
+            tailWordIds.push_back(bounds[i].i_wordId);
+
+        ScoreAccumulator *tailWeights = rankImages(snapshot, indexHits, wordWeights,
+                                                   tailWordIds, weights);
+        weights->reduce(*tailWeights);
+        releaseAccumulator(tailWeights);
+    }
 
-    gettimeofday(&t[6], NULL);
-    cout << "time: " << getTimeDiff(t[5], t[6]) << " ms." << endl;
-    cout << "Returning the results. " << endl;
+    return weights;
+}
 
-    returnResults(rerankedResults, request, 100);
 
-    return SEARCH_RESULTS;
+/**
+ * @brief Compare the first scores of the pruned ranking with the ones of
+ * the exhaustive ranking and log the differences.
+ * @param snapshot the snapshot of the index.
+ * @param indexHits the hits of the words of the request.
+ * @param wordWeights the tf-idf weights of the words of the request.
+ * @param weights the scores of the pruned ranking.
+ * @param k the number of results that must be exact.
+ */
+void ORBSearcher::checkRanking(const IndexSnapshot &snapshot,
+                               std::unordered_map<u_int32_t, WordHits> &indexHits,
+                               const std::unordered_map<u_int32_t, float> &wordWeights,
+                               const ScoreAccumulator &weights, unsigned k)
+{
+    vector<u_int32_t> wordIds;
+    for (std::unordered_map<u_int32_t, WordHits>::const_iterator it = indexHits.begin();
+         it != indexHits.end(); ++it)
+        wordIds.push_back(it->first);
+    ScoreAccumulator *exactWeights = rankImages(snapshot, indexHits, wordWeights,
+                                                wordIds, NULL);
+
+    vector<SearchResult> results, exactResults;
+    weights.getFirstResults(k, results);
+    exactWeights->getFirstResults(k, exactResults);
+    exactWeights->reset();
+    releaseAccumulator(exactWeights);
+
+    /* The scores are compared instead of the images since the images with
+     * the same score can be ordered differently. */
+    unsigned i_nbErrors = 0;
+    for (unsigned i = 0; i < exactResults.size(); ++i)
+    {
+        const float f_exactScore = exactResults[i].f_weight;
+        if (i >= results.size()
+            || fabs(results[i].f_weight - f_exactScore) > RANKING_PRUNING_MARGIN * f_exactScore)
+            i_nbErrors++;
+    }
+
+    if (i_nbErrors > 0)
+        cout << "Pruned ranking check failed: " << i_nbErrors << " of the first "
+             << k << " scores differ." << endl;
+    else
+        cout << "Pruned ranking check passed." << endl;
 }
 
 
@@ -324,6 +728,51 @@ void ORBSearcher::returnResults(priority_queue<SearchResult> &rankedResults,
 }
 
 
+/**
+ * @brief Return the number of the first images of the tf-idf ranking to
+ * rerank. The reranking stops once the scores fall under a fraction of the
+ * first one or after a marked knee of the scores: the normalized scores are
+ * compared to the chord between the first and the last one, their largest
+ * distance under it being the knee.
+ * @param rankedResults the first images of the ranking by decreasing score.
+ * @return the number of images to rerank.
+ */
+unsigned ORBSearcher::getRerankingDepth(const vector<SearchResult> &rankedResults) const
+{
+    const unsigned i_nbImages = rankedResults.size();
+    if (i_nbImages <= RERANKING_MIN_NB_IMAGES)
+        return i_nbImages;
+
+    const float f_firstScore = rankedResults.front().f_weight;
+    const float f_lastScore = rankedResults.back().f_weight;
+
+    unsigned i_depth = RERANKING_MIN_NB_IMAGES;
+    while (i_depth < i_nbImages
+           && rankedResults[i_depth].f_weight >= RERANKING_MIN_SCORE_RATIO * f_firstScore)
+        i_depth++;
+
+    if (f_firstScore <= f_lastScore)
+        return i_depth;
+
+    float f_maxDist = 0;
+    unsigned i_knee = 0;
+    for (unsigned i = 0; i < i_nbImages; ++i)
+    {
+        const float f_x = (float)i / (i_nbImages - 1);
+        const float f_y = (rankedResults[i].f_weight - f_lastScore) / (f_firstScore - f_lastScore);
+        if (1 - f_x - f_y > f_maxDist)
+        {
+            f_maxDist = 1 - f_x - f_y;
+            i_knee = i;
+        }
+    }
+    if (f_maxDist >= RERANKING_MIN_KNEE_DEPTH)
+        i_depth = min(i_depth, max(2 * (i_knee + 1), (unsigned)RERANKING_MIN_NB_IMAGES));
+
+    return i_depth;
+}
+
+
 /**
  * @brief Get the time difference in ms between two instants.
  * @param t1
@@ -0,0 +1,200 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include <postingcodec.h>
+
+
+#ifdef __SSE2__
+/**
+ * @brief The shuffle masks that expand the data bytes of four ids
+ * to four u_int32_t for each possible control byte.
+ */
+struct DecodingTables
+{
+    DecodingTables()
+    {
+        for (unsigned c = 0; c < 256; ++c)
+        {
+            u_int8_t i_offset = 0;
+            for (unsigned i = 0; i < 4; ++i)
+            {
+                const unsigned i_length = ((c >> (2 * i)) & 3) + 1;
+                for (unsigned j = 0; j < 4; ++j)
+                    shuffleMasks[c][4 * i + j] = j < i_length ? i_offset + j : 0x80;
+                i_offset += i_length;
+            }
+            lengths[c] = i_offset;
+        }
+    }
+
+    u_int8_t shuffleMasks[256][16] __attribute__((aligned(16)));
+    u_int8_t lengths[256];
+};
+
+static const DecodingTables decodingTables;
+
+
+/**
+ * @brief Decode the groups of four ids of a list with SSSE3.
+ * @param p_control the control bytes.
+ * @param p_data the data bytes, moved after the decoded groups.
+ * @param i_nbIds the number of ids.
+ * @param p_ids the output buffer of i_nbIds ids.
+ * @param i_prev the returned last decoded id.
+ * @return the number of decoded ids.
+ */
+__attribute__((target("ssse3")))
+static u_int64_t decodeSSSE3(const u_int8_t *p_control, const u_int8_t *&p_data,
+                             u_int64_t i_nbIds, u_int32_t *p_ids, u_int32_t &i_prev)
+{
+    u_int64_t i = 0;
+    __m128i prev = _mm_setzero_si128();
+    for (; i + 4 <= i_nbIds; i += 4)
+    {
+        const u_int8_t c = p_control[i / 4];
+        const __m128i mask = _mm_load_si128((const __m128i *)decodingTables.shuffleMasks[c]);
+        __m128i deltas = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p_data), mask);
+        p_data += decodingTables.lengths[c];
+
+        // Prefix sum of the deltas.
+        deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 4));
+        deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 8));
+        prev = _mm_add_epi32(deltas, prev);
+        _mm_storeu_si128((__m128i *)(p_ids + i), prev);
+        prev = _mm_shuffle_epi32(prev, 0xFF);
+    }
+    i_prev = _mm_cvtsi128_si32(prev);
+
+    return i;
+}
+#endif
+
+
+/**
+ * @brief Return the maximum size of the encoding of a list of ids.
+ * @param i_nbIds the number of ids.
+ * @return the size in bytes.
+ */
+u_int64_t PostingCodec::maxEncodedSize(u_int64_t i_nbIds)
+{
+    return (i_nbIds + 3) / 4 + 4 * i_nbIds;
+}
+
+
+/**
+ * @brief Return the exact size of the encoding of a sorted list of ids.
+ * @param p_ids the ids.
+ * @param i_nbIds the number of ids.
+ * @return the size in bytes.
+ */
+u_int64_t PostingCodec::encodedSize(const u_int32_t *p_ids, u_int64_t i_nbIds)
+{
+    u_int64_t i_size = (i_nbIds + 3) / 4;
+    u_int32_t i_prev = 0;
+    for (u_int64_t i = 0; i < i_nbIds; ++i)
+    {
+        const u_int32_t i_delta = p_ids[i] - i_prev;
+        i_prev = p_ids[i];
+        i_size += i_delta >= (1 << 24) ? 4 : i_delta >= (1 << 16) ? 3
+                  : i_delta >= (1 << 8) ? 2 : 1;
+    }
+    return i_size;
+}
+
+
+/**
+ * @brief Encode a sorted list of ids.
+ * @param p_ids the ids.
+ * @param i_nbIds the number of ids.
+ * @param p_out the output buffer of at least maxEncodedSize(i_nbIds) bytes.
+ * @return the number of written bytes.
+ */
+u_int64_t PostingCodec::encode(const u_int32_t *p_ids, u_int64_t i_nbIds,
+                               u_int8_t *p_out)
+{
+    u_int8_t *p_control = p_out;
+    u_int8_t *p_data = p_out + (i_nbIds + 3) / 4;
+    memset(p_control, 0, (i_nbIds + 3) / 4);
+
+    u_int32_t i_prev = 0;
+    for (u_int64_t i = 0; i < i_nbIds; ++i)
+    {
+        u_int32_t i_delta = p_ids[i] - i_prev;
+        i_prev = p_ids[i];
+
+        unsigned i_code = 0;
+        if (i_delta >= (1 << 24))
+            i_code = 3;
+        else if (i_delta >= (1 << 16))
+            i_code = 2;
+        else if (i_delta >= (1 << 8))
+            i_code = 1;
+
+        p_control[i / 4] |= i_code << (2 * (i % 4));
+        for (unsigned j = 0; j <= i_code; ++j)
+        {
+            *p_data++ = i_delta & 0xFF;
+            i_delta >>= 8;
+        }
+    }
+
+    return p_data - p_out;
+}
+
+
+/**
+ * @brief Decode a list of ids.
+ * @param p_in the encoded ids followed by at least POSTING_CODEC_PADDING bytes.
+ * @param i_nbIds the number of ids.
+ * @param p_ids the output buffer of i_nbIds ids.
+ */
+void PostingCodec::decode(const u_int8_t *p_in, u_int64_t i_nbIds,
+                          u_int32_t *p_ids)
+{
+    const u_int8_t *p_control = p_in;
+    const u_int8_t *p_data = p_in + (i_nbIds + 3) / 4;
+    u_int64_t i = 0;
+    u_int32_t i_prev = 0;
+
+#ifdef __SSE2__
+    static const bool b_hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (b_hasSSSE3)
+        i = decodeSSSE3(p_control, p_data, i_nbIds, p_ids, i_prev);
+#endif
+
+    for (; i < i_nbIds; ++i)
+    {
+        const unsigned i_length = ((p_control[i / 4] >> (2 * (i % 4))) & 3) + 1;
+        u_int32_t i_delta = 0;
+        for (unsigned j = 0; j < i_length; ++j)
+            i_delta |= (u_int32_t)p_data[j] << (8 * j);
+        p_data += i_length;
+
+        i_prev += i_delta;
+        p_ids[i] = i_prev;
+    }
+}
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <memory>
 #include <sstream>
+#include <cstring>
+#include <list>
 
 #include <json/json.h>
 
@@ -120,6 +122,7 @@ void RequestHandler::handleRequest(ConnectionInfo &conInfo)
     vector<string> parsedURI = parseURI(conInfo.url);
 
     string p_image[] = {"index", "images", "IDENTIFIER", ""};
+    string p_imageBatch[] = {"index", "images", "batch", ""};
     string p_tag[] = {"index", "images", "IDENTIFIER", "tag", ""};
     string p_searchImage[] = {"index", "searcher", ""};
     string p_ioIndex[] = {"index", "io", ""};
@@ -133,6 +136,81 @@ void RequestHandler::handleRequest(ConnectionInfo &conInfo)
         conInfo.answerCode = MHD_HTTP_FORBIDDEN;
         ret["type"] = Converter::codeToString(AUTHENTIFICATION_ERROR);
     }
+    else if (testURIWithPattern(parsedURI, p_imageBatch)
+             && conInfo.connectionType == POST)
+    {
+        vector<unsigned> imageIds;
+        vector<unsigned> imgSizes;
+        vector<char *> imgData;
+        list<vector<char> > downloadedData;
+        Json::Value imagesVal(Json::arrayValue);
+
+        u_int32_t i_ret = parseImageBatch(conInfo.uploadedData, imageIds, imgSizes, imgData);
+        if (i_ret == MISFORMATTED_REQUEST)
+        {
+            imageIds.clear();
+            imgSizes.clear();
+            imgData.clear();
+
+            // Check if the data is a list of image URLs to load
+            string dataStr(conInfo.uploadedData.begin(),
+                           conInfo.uploadedData.end());
+
+            Json::Value data = StringToJson(dataStr);
+            const Json::Value &images = data["images"];
+            if (images.isArray())
+            {
+                i_ret = OK;
+                for (unsigned i = 0; i < images.size(); ++i)
+                {
+                    u_int32_t i_imageId = images[i]["image_id"].asUInt();
+                    string imgURL = images[i]["url"].asString();
+
+                    long HTTPResponseCode = 0;
+                    u_int32_t i_downloadRet = IMAGE_NOT_DECODED;
+                    downloadedData.push_back(vector<char>());
+                    if (imgDownloader->canDownloadImage(imgURL))
+                        i_downloadRet = imgDownloader->getImageData(imgURL, downloadedData.back(),
+                                                                    HTTPResponseCode);
+                    if (i_downloadRet == OK)
+                    {
+                        imageIds.push_back(i_imageId);
+                        imgSizes.push_back(downloadedData.back().size());
+                        imgData.push_back(downloadedData.back().data());
+                    }
+                    else
+                    {
+                        Json::Value imageVal;
+                        imageVal["type"] = Converter::codeToString(i_downloadRet);
+                        imageVal["image_id"] = Json::Value(i_imageId);
+                        if (i_downloadRet == IMAGE_DOWNLOADER_HTTP_ERROR)
+                            imageVal["image_downloader_http_response_code"] = (Json::Int64)HTTPResponseCode;
+                        imagesVal.append(imageVal);
+                    }
+                }
+            }
+        }
+
+        if (i_ret == OK)
+        {
+            vector<u_int32_t> results;
+            vector<unsigned> nbFeaturesExtracted;
+            i_ret = featureExtractor->processNewImages(imageIds, imgSizes, imgData,
+                                                       results, nbFeaturesExtracted);
+            for (unsigned i = 0; i < imageIds.size(); ++i)
+            {
+                Json::Value imageVal;
+                imageVal["type"] = Converter::codeToString(results[i]);
+                imageVal["image_id"] = Json::Value(imageIds[i]);
+                if (results[i] == IMAGE_ADDED)
+                    imageVal["nb_features_extracted"] = Json::Value(nbFeaturesExtracted[i]);
+                imagesVal.append(imageVal);
+            }
+            ret["images"] = imagesVal;
+        }
+
+        ret["type"] = Converter::codeToString(i_ret);
+    }
     else if (testURIWithPattern(parsedURI, p_image)
         && conInfo.connectionType == PUT)
     {
@@ -207,7 +285,9 @@ void RequestHandler::handleRequest(ConnectionInfo &conInfo)
 
         req.imageData = conInfo.uploadedData;
         req.client = NULL;
-        u_int32_t i_ret = imageSearcher->searchImage(req);
+        u_int32_t i_ret = parseSearchParameters(conInfo, req);
+        if (i_ret == OK)
+            i_ret = imageSearcher->searchImage(req);
 
         if (i_ret == IMAGE_NOT_DECODED)
         {
@@ -273,7 +353,9 @@ void RequestHandler::handleRequest(ConnectionInfo &conInfo)
 
         req.imageId = atoi(parsedURI[2].c_str());
         req.client = NULL;
-        u_int32_t i_ret = imageSearcher->searchSimilar(req);
+        u_int32_t i_ret = parseSearchParameters(conInfo, req);
+        if (i_ret == OK)
+            i_ret = imageSearcher->searchSimilar(req);
 
         ret["type"] = Converter::codeToString(i_ret);
 
@@ -375,6 +457,129 @@ void RequestHandler::handleRequest(ConnectionInfo &conInfo)
 }
 
 
+/**
+ * @brief Read the parameters of a search from the arguments of the query
+ * string: rerank_depth, the maximal number of reranked images, adaptive_depth,
+ * "true" to stop the reranking earlier once the tf-idf scores have dropped,
+ * max_results, geometric_verification, "false" to return the first images of the
+ * tf-idf ranking without reranking them, first_match, "true" to stop the
+ * verification at the first image whose score reaches first_match_min_score,
+ * and nb_probes, the number of visual words each descriptor of a searched
+ * image is assigned to. The missing ones keep their default.
+ * @param conInfo the connection.
+ * @param req the search request.
+ * @return OK if the arguments are valid, else MISFORMATTED_REQUEST.
+ */
+u_int32_t RequestHandler::parseSearchParameters(const ConnectionInfo &conInfo, SearchRequest &req)
+{
+    if (!parseUnsignedArgument(conInfo, "rerank_depth", MAX_NB_RERANKED_IMAGES,
+                               req.i_nbRerankedImages)
+        || !parseBoolArgument(conInfo, "adaptive_depth", req.b_adaptiveDepth)
+        || !parseUnsignedArgument(conInfo, "max_results", MAX_NB_RESULTS,
+                                  req.i_maxNbResults)
+        || !parseBoolArgument(conInfo, "geometric_verification", req.b_geometricVerification)
+        || !parseBoolArgument(conInfo, "first_match", req.b_firstMatch)
+        || !parseUnsignedArgument(conInfo, "first_match_min_score", MAX_FIRST_MATCH_MIN_SCORE,
+                                  req.i_firstMatchMinScore)
+        || !parseUnsignedArgument(conInfo, "nb_probes", MAX_NB_PROBES, req.i_nbProbes))
+        return MISFORMATTED_REQUEST;
+
+    return OK;
+}
+
+
+/**
+ * @brief Read a boolean argument of the query string.
+ * @param conInfo the connection.
+ * @param name the name of the argument.
+ * @param b_value the value, unchanged if the argument is missing.
+ * @return false if the argument is not "true", "1", "false" or "0".
+ */
+bool RequestHandler::parseBoolArgument(const ConnectionInfo &conInfo, string name,
+                                       bool &b_value)
+{
+    map<string, string>::const_iterator it = conInfo.arguments.find(name);
+    if (it == conInfo.arguments.end())
+        return true;
+
+    if (it->second == "true" || it->second == "1")
+        b_value = true;
+    else if (it->second == "false" || it->second == "0")
+        b_value = false;
+    else
+        return false;
+
+    return true;
+}
+
+
+/**
+ * @brief Read an unsigned argument of the query string.
+ * @param conInfo the connection.
+ * @param name the name of the argument.
+ * @param i_max the maximal value of the argument.
+ * @param i_value the value, unchanged if the argument is missing.
+ * @return false if the argument is not a number between 1 and i_max.
+ */
+bool RequestHandler::parseUnsignedArgument(const ConnectionInfo &conInfo, string name,
+                                           unsigned i_max, unsigned &i_value)
+{
+    map<string, string>::const_iterator it = conInfo.arguments.find(name);
+    if (it == conInfo.arguments.end())
+        return true;
+
+    char *p;
+    const long n = strtol(it->second.c_str(), &p, 10);
+    if (it->second.empty() || *p != '\0' || n < 1 || n > (long)i_max)
+        return false;
+
+    i_value = n;
+    return true;
+}
+
+
+/**
+ * @brief Parse the binary data of a batch of images.
+ * The data is a sequence of images, each one made of its id and the size
+ * of its data as little-endian u_int32_t followed by its data.
+ * @param data the uploaded data.
+ * @param imageIds the image ids.
+ * @param imgSizes the sizes of the image data.
+ * @param imgData the pointers to the image data in the uploaded data.
+ * @return OK if the data is a valid batch, else MISFORMATTED_REQUEST.
+ */
+u_int32_t RequestHandler::parseImageBatch(vector<char> &data,
+                                          vector<unsigned> &imageIds,
+                                          vector<unsigned> &imgSizes,
+                                          vector<char *> &imgData)
+{
+    size_t i_pos = 0;
+    while (i_pos < data.size())
+    {
+        if (data.size() - i_pos < 2 * sizeof(u_int32_t))
+            return MISFORMATTED_REQUEST;
+
+        u_int32_t i_imageId, i_imgSize;
+        memcpy(&i_imageId, data.data() + i_pos, sizeof(u_int32_t));
+        memcpy(&i_imgSize, data.data() + i_pos + sizeof(u_int32_t), sizeof(u_int32_t));
+        i_pos += 2 * sizeof(u_int32_t);
+
+        if (i_imgSize == 0 || data.size() - i_pos < i_imgSize)
+            return MISFORMATTED_REQUEST;
+
+        imageIds.push_back(i_imageId);
+        imgSizes.push_back(i_imgSize);
+        imgData.push_back(data.data() + i_pos);
+        i_pos += i_imgSize;
+    }
+
+    if (imageIds.empty())
+        return MISFORMATTED_REQUEST;
+
+    return OK;
+}
+
+
 /**
  * @brief Conver to JSON value to a string.
  * @param data the JSON value.
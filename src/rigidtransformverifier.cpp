@@ -0,0 +1,617 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+#include <algorithm>
+#include <functional>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include <rigidtransformverifier.h>
+
+
+/**
+ * @brief Solve a 3x3 linear system with the Cramer's rule.
+ * @param A the matrix.
+ * @param r the right hand side.
+ * @param x the solution.
+ * @return false if the matrix is singular.
+ */
+static bool solve3x3(const double A[3][3], const double r[3], double x[3])
+{
+    const double c0 = A[1][1] * A[2][2] - A[1][2] * A[2][1];
+    const double c1 = A[1][0] * A[2][2] - A[1][2] * A[2][0];
+    const double c2 = A[1][0] * A[2][1] - A[1][1] * A[2][0];
+    const double det = A[0][0] * c0 - A[0][1] * c1 + A[0][2] * c2;
+    if (fabs(det) < 1e-12)
+        return false;
+
+    x[0] = (r[0] * c0
+            - A[0][1] * (r[1] * A[2][2] - A[1][2] * r[2])
+            + A[0][2] * (r[1] * A[2][1] - A[1][1] * r[2])) / det;
+    x[1] = (A[0][0] * (r[1] * A[2][2] - A[1][2] * r[2])
+            - r[0] * c1
+            + A[0][2] * (A[1][0] * r[2] - r[1] * A[2][0])) / det;
+    x[2] = (A[0][0] * (A[1][1] * r[2] - r[1] * A[2][1])
+            - A[0][1] * (A[1][0] * r[2] - r[1] * A[2][0])
+            + r[0] * c2) / det;
+    return true;
+}
+
+
+/**
+ * @brief Compare two correspondences by decreasing quality.
+ */
+struct CompareQualities
+{
+    CompareQualities(const vector<float> &qualities) : qualities(qualities) { }
+
+    bool operator()(unsigned a, unsigned b) const
+    {
+        return qualities[a] > qualities[b];
+    }
+
+    const vector<float> &qualities;
+};
+
+
+/**
+ * @brief Look for an affine transform of the points of src1 to the points
+ * of src2 supported by at least RANSAC_MIN_INLINERS correspondences.
+ * @param src1 the points of the first image.
+ * @param src2 the corresponding points of the second image.
+ * @param qualities the quality of each correspondence for the PROSAC mode,
+ * the samples are uniform if it is empty.
+ * @param M the transform fitted on its inliers if one is found.
+ * @return true if a transform is found.
+ */
+bool RigidTransformVerifier::verify(const vector<Point2f> &src1, const vector<Point2f> &src2,
+                                    const vector<float> &qualities, double M[6])
+{
+    assert(src1.size() == src2.size());
+    const int count = src1.size();
+    const int RANSAC_SIZE0 = 3;
+
+    i_nbIterations = 0;
+    if (count < RANSAC_SIZE0)
+        return false;
+
+    // The PROSAC samples are drawn from the first correspondences.
+    const bool b_prosac = prosacSampling && (int)qualities.size() == count;
+    order.resize(count);
+    for (int i = 0; i < count; ++i)
+        order[i] = i;
+    if (b_prosac)
+        stable_sort(order.begin(), order.end(), CompareQualities(qualities));
+
+    loadPoints(src1, src2);
+
+    const unsigned i_maxNbModels = getMaxNbModels(count);
+    unsigned i_nbModels = 0;
+
+    /* The PROSAC samples are drawn from the first n correspondences. T_n is
+     * the average number of samples among T_N that only hold some of these
+     * correspondences and TPrime_n the iteration at which n grows. Until
+     * then, the samples hold the n-th correspondence. T_N is the number of
+     * models to test so that all the correspondences are drawn before the
+     * end when the qualities do not tell the inliers apart. */
+    int n = RANSAC_SIZE0;
+    double T_n = i_maxNbModels;
+    for (int i = 0; i < RANSAC_SIZE0; ++i)
+        T_n *= (double)(RANSAC_SIZE0 - i) / (count - i);
+    double TPrime_n = 1;
+    const int i_maxNbDraws = b_prosac ? PROSAC_MAX_NB_DRAWS : RANSAC_MAX_NB_ITERATIONS;
+
+    RandomGenerator rng;
+    int i, j, k, k1;
+    for (k = 0; k < RANSAC_MAX_NB_ITERATIONS && i_nbModels < i_maxNbModels; ++k)
+    {
+        int idx[RANSAC_SIZE0];
+
+        int i_nbDrawnPoints = count;
+        bool b_withLastPoint = false;
+        if (b_prosac)
+        {
+            while (k + 1 > TPrime_n && n < count)
+            {
+                const double T_nextN = T_n * (n + 1) / (n + 1 - RANSAC_SIZE0);
+                TPrime_n += ceil(T_nextN - T_n);
+                T_n = T_nextN;
+                n++;
+            }
+            b_withLastPoint = k + 1 <= TPrime_n;
+            i_nbDrawnPoints = b_withLastPoint ? n - 1 : n;
+        }
+
+        // Choose 3 random points that are neither close nor aligned.
+        for (i = 0; i < RANSAC_SIZE0; ++i)
+        {
+            for (k1 = 0; k1 < i_maxNbDraws; ++k1)
+            {
+                if (i == 0 && b_withLastPoint)
+                    idx[i] = n - 1;
+                else
+                    idx[i] = rng.uniform(0, i_nbDrawnPoints);
+
+                for (j = 0; j < i; ++j)
+                {
+                    if (idx[j] == idx[i])
+                        break;
+                    float u = ax[idx[i]] - ax[idx[j]];
+                    float v = ay[idx[i]] - ay[idx[j]];
+                    if (u * u + v * v < 20 * 20)
+                        break;
+                    u = bx[idx[i]] - bx[idx[j]];
+                    v = by[idx[i]] - by[idx[j]];
+                    if (u * u + v * v < 20 * 20)
+                        break;
+                }
+
+                if (j < i)
+                    continue;
+
+                if (i + 1 == RANSAC_SIZE0)
+                {
+                    double dax1 = ax[idx[1]] - ax[idx[0]], day1 = ay[idx[1]] - ay[idx[0]];
+                    double dax2 = ax[idx[2]] - ax[idx[0]], day2 = ay[idx[2]] - ay[idx[0]];
+                    double dbx1 = bx[idx[1]] - bx[idx[0]], dby1 = by[idx[1]] - by[idx[0]];
+                    double dbx2 = bx[idx[2]] - bx[idx[0]], dby2 = by[idx[2]] - by[idx[0]];
+                    const double eps = 0.2;
+
+                    if (fabs(dax1 * day2 - day1 * dax2) < eps * sqrt(dax1 * dax1 + day1 * day1) * sqrt(dax2 * dax2 + day2 * day2)
+                        || fabs(dbx1 * dby2 - dby1 * dbx2) < eps * sqrt(dbx1 * dbx1 + dby1 * dby1) * sqrt(dbx2 * dbx2 + dby2 * dby2))
+                        continue;
+                }
+                break;
+            }
+
+            if (k1 >= i_maxNbDraws)
+                break;
+        }
+
+        if (i < RANSAC_SIZE0)
+            continue;
+
+        i_nbModels++;
+
+        // The affine transform of the 3 points.
+        double A[3][3], rx[3], ry[3], sampleM[6];
+        for (i = 0; i < RANSAC_SIZE0; ++i)
+        {
+            A[i][0] = ax[idx[i]];
+            A[i][1] = ay[idx[i]];
+            A[i][2] = 1;
+            rx[i] = bx[idx[i]];
+            ry[i] = by[idx[i]];
+        }
+        if (!solve3x3(A, rx, sampleM) || !solve3x3(A, ry, sampleM + 3))
+            continue;
+
+        if (!checkTransformedRect(sampleM))
+            continue;
+
+        if (countInliers(sampleM, count) >= RANSAC_MIN_INLINERS)
+        {
+            i_nbIterations = k + 1;
+            if (!fitInliers(sampleM, count, RANSAC_MAX_SQUARED_ERROR, M))
+                copy(sampleM, sampleM + 6, M);
+            return true;
+        }
+    }
+
+    i_nbIterations = k;
+    return false;
+}
+
+
+/**
+ * @brief Store the coordinates of the points in the order of the order array
+ * and compute the bounding rectangle of the points of the first image.
+ * @param src1 the points of the first image.
+ * @param src2 the corresponding points of the second image.
+ */
+void RigidTransformVerifier::loadPoints(const vector<Point2f> &src1, const vector<Point2f> &src2)
+{
+    const unsigned count = src1.size();
+
+    /* The padding points are never inliers: their distance to any projected
+     * point overflows. */
+    const unsigned i_nbPaddedPoints = (count + 7) & ~7;
+    ax.assign(i_nbPaddedPoints, 0);
+    ay.assign(i_nbPaddedPoints, 0);
+    bx.assign(i_nbPaddedPoints, FLT_MAX);
+    by.assign(i_nbPaddedPoints, FLT_MAX);
+    float f_minX = src1[0].x, f_maxX = src1[0].x;
+    float f_minY = src1[0].y, f_maxY = src1[0].y;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        ax[i] = src1[order[i]].x;
+        ay[i] = src1[order[i]].y;
+        bx[i] = src2[order[i]].x;
+        by[i] = src2[order[i]].y;
+        f_minX = min(f_minX, ax[i]);
+        f_maxX = max(f_maxX, ax[i]);
+        f_minY = min(f_minY, ay[i]);
+        f_maxY = max(f_maxY, ay[i]);
+    }
+
+    // The bounding rectangle of the points of the first image, as cv::boundingRect.
+    const int i_rectX = floor(f_minX), i_rectY = floor(f_minY);
+    const int i_rectWidth = (int)floor(f_maxX) - i_rectX + 1;
+    const int i_rectHeight = (int)floor(f_maxY) - i_rectY + 1;
+    rectPoints[0] = Point2f(i_rectX, i_rectY);
+    rectPoints[1] = Point2f(i_rectX + i_rectWidth, i_rectY);
+    rectPoints[2] = Point2f(i_rectX + i_rectWidth, i_rectY + i_rectHeight);
+    rectPoints[3] = Point2f(i_rectX, i_rectY + i_rectHeight);
+}
+
+
+/**
+ * @brief Look for an affine transform of the points of src1 to the points
+ * of src2 supported by at least RANSAC_MIN_INLINERS correspondences with a
+ * Hough transform instead of random samples.
+ * Each correspondence votes for the similarities that map its point of the
+ * first image on its point of the second image with the rotation of its
+ * keypoints. The hits do not hold the scale of their keypoint so a vote is
+ * cast in each scale bin, the translation being computed for the scale of
+ * the bin. The translation bins are a fraction of the size of the first
+ * image at this scale. The transforms of the bins with the most votes are
+ * refined on all the correspondences with a decreasing inlier threshold.
+ * @param src1 the points of the first image.
+ * @param src2 the corresponding points of the second image.
+ * @param rotations the rotations in degrees from the keypoints of the first
+ * image to the ones of the second image.
+ * @param M the transform fitted on its inliers if one is found.
+ * @return true if a transform is found.
+ */
+bool RigidTransformVerifier::verifyPose(const vector<Point2f> &src1, const vector<Point2f> &src2,
+                                        const vector<float> &rotations, double M[6])
+{
+    assert(src1.size() == src2.size());
+    assert(rotations.size() == src1.size());
+    const unsigned count = src1.size();
+
+    i_nbIterations = 0;
+    if (count < RANSAC_MIN_INLINERS)
+        return false;
+
+    order.resize(count);
+    for (unsigned i = 0; i < count; ++i)
+        order[i] = i;
+    loadPoints(src1, src2);
+
+    const float f_imageSize = max(rectPoints[2].x - rectPoints[0].x,
+                                  rectPoints[2].y - rectPoints[0].y);
+    float scales[HOUGH_NB_SCALE_BINS], binSizes[HOUGH_NB_SCALE_BINS];
+    for (unsigned i = 0; i < HOUGH_NB_SCALE_BINS; ++i)
+    {
+        scales[i] = exp2(HOUGH_MIN_LOG_SCALE + (i + 0.5f) * HOUGH_LOG_SCALE_BIN_SIZE);
+        binSizes[i] = max(HOUGH_MIN_TRANSLATION_BIN_SIZE,
+                          scales[i] * f_imageSize / HOUGH_NB_TRANSLATION_BINS);
+    }
+
+    // The votes are the keys of their bins, sorted to count them.
+    votes.resize(count * HOUGH_NB_SCALE_BINS);
+    pointRotations.resize(count);
+    pointCos.resize(count);
+    pointSin.resize(count);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        float f_rotation = fmod(rotations[i], 360.0f);
+        if (f_rotation < 0)
+            f_rotation += 360;
+        pointRotations[i] = f_rotation;
+        pointCos[i] = cos(f_rotation * (float)M_PI / 180);
+        pointSin[i] = sin(f_rotation * (float)M_PI / 180);
+
+        for (unsigned j = 0; j < HOUGH_NB_SCALE_BINS; ++j)
+            votes[i * HOUGH_NB_SCALE_BINS + j] = getPoseBin(i, j, scales[j], binSizes[j]);
+    }
+    sort(votes.begin(), votes.end());
+
+    // The bins with the most votes.
+    peaks.clear();
+    for (unsigned i = 0; i < votes.size();)
+    {
+        unsigned j = i + 1;
+        while (j < votes.size() && votes[j] == votes[i])
+            ++j;
+        if (j - i >= HOUGH_MIN_NB_VOTES)
+            peaks.push_back(make_pair(j - i, votes[i]));
+        i = j;
+    }
+    const unsigned i_nbPeaks = min((unsigned)peaks.size(), (unsigned)HOUGH_NB_PEAKS);
+    partial_sort(peaks.begin(), peaks.begin() + i_nbPeaks, peaks.end(),
+                 greater<pair<unsigned, u_int32_t> >());
+
+    for (unsigned k = 0; k < i_nbPeaks; ++k)
+    {
+        i_nbIterations++;
+
+        // The similarity of the bin, averaged over its correspondences.
+        const u_int32_t i_bin = peaks[k].second;
+        const unsigned i_scaleBin = (i_bin >> HOUGH_SCALE_SHIFT) & ((1 << HOUGH_SCALE_BITS) - 1);
+        const float f_scale = scales[i_scaleBin];
+        double f_rotationSum = 0;
+        unsigned i_nbBinPoints = 0;
+        pointBins.resize(count);
+        for (unsigned i = 0; i < count; ++i)
+        {
+            pointBins[i] = getPoseBin(i, i_scaleBin, f_scale, binSizes[i_scaleBin]);
+            if (pointBins[i] == i_bin)
+            {
+                f_rotationSum += pointRotations[i];
+                i_nbBinPoints++;
+            }
+        }
+        const double f_angle = f_rotationSum / i_nbBinPoints * M_PI / 180;
+        const double f_cos = f_scale * cos(f_angle), f_sin = f_scale * sin(f_angle);
+        double f_tx = 0, f_ty = 0;
+        for (unsigned i = 0; i < count; ++i)
+            if (pointBins[i] == i_bin)
+            {
+                f_tx += bx[i] - (f_cos * ax[i] - f_sin * ay[i]);
+                f_ty += by[i] - (f_sin * ax[i] + f_cos * ay[i]);
+            }
+        double binM[6] = {f_cos, -f_sin, f_tx / i_nbBinPoints,
+                          f_sin, f_cos, f_ty / i_nbBinPoints};
+
+        /* The threshold starts at the half of the translation bin size and
+         * is halved at each refinement down to the inlier one. */
+        float f_maxSquaredError = binSizes[i_scaleBin] * binSizes[i_scaleBin] / 4;
+        bool b_fitted = true;
+        while (b_fitted)
+        {
+            f_maxSquaredError = max(f_maxSquaredError, RANSAC_MAX_SQUARED_ERROR);
+            double fittedM[6];
+            b_fitted = fitInliers(binM, count, f_maxSquaredError, fittedM);
+            if (b_fitted)
+                copy(fittedM, fittedM + 6, binM);
+            if (f_maxSquaredError == RANSAC_MAX_SQUARED_ERROR)
+                break;
+            f_maxSquaredError /= 4;
+        }
+        if (!b_fitted)
+            continue;
+
+        if (checkTransformedRect(binM) && countInliers(binM, count) >= RANSAC_MIN_INLINERS)
+        {
+            copy(binM, binM + 6, M);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief Return the bin of the pose voted by a correspondence in a scale bin.
+ * @param i the correspondence.
+ * @param i_scaleBin the scale bin.
+ * @param f_scale the scale of the bin.
+ * @param f_binSize the size of the translation bins at this scale.
+ * @return the key of the bin.
+ */
+u_int32_t RigidTransformVerifier::getPoseBin(unsigned i, unsigned i_scaleBin,
+                                             float f_scale, float f_binSize) const
+{
+    const float f_cos = f_scale * pointCos[i], f_sin = f_scale * pointSin[i];
+    const float f_tx = bx[i] - (f_cos * ax[i] - f_sin * ay[i]);
+    const float f_ty = by[i] - (f_sin * ax[i] + f_cos * ay[i]);
+
+    const int i_maxTranslationBin = (1 << (HOUGH_TRANSLATION_BITS - 1)) - 1;
+    const int i_txBin = max(-i_maxTranslationBin, min(i_maxTranslationBin, (int)floor(f_tx / f_binSize)));
+    const int i_tyBin = max(-i_maxTranslationBin, min(i_maxTranslationBin, (int)floor(f_ty / f_binSize)));
+    const u_int32_t i_rotationBin = min((unsigned)(pointRotations[i] / 360 * HOUGH_NB_ROTATION_BINS),
+                                        (unsigned)HOUGH_NB_ROTATION_BINS - 1);
+    const u_int32_t i_translationMask = (1 << HOUGH_TRANSLATION_BITS) - 1;
+
+    return (i_rotationBin << HOUGH_ROTATION_SHIFT) | (i_scaleBin << HOUGH_SCALE_SHIFT)
+           | (((u_int32_t)i_txBin & i_translationMask) << HOUGH_TRANSLATION_BITS)
+           | ((u_int32_t)i_tyBin & i_translationMask);
+}
+
+
+/**
+ * @brief Return the number of transforms to test before giving up.
+ * A transform supported by RANSAC_MIN_INLINERS of the i_nbPoints
+ * correspondences is tested with a probability of RANSAC_CONFIDENCE.
+ * @param i_nbPoints the number of correspondences.
+ */
+unsigned RigidTransformVerifier::getMaxNbModels(unsigned i_nbPoints) const
+{
+    if (!adaptiveNbIterations)
+        return RANSAC_MAX_NB_ITERATIONS;
+
+    const double f_inlierRatio = (double)RANSAC_MIN_INLINERS / i_nbPoints;
+    if (f_inlierRatio >= 1)
+        return RANSAC_MIN_NB_MODELS;
+
+    const double f_nbModels = ceil(log(1 - RANSAC_CONFIDENCE)
+                                   / log(1 - f_inlierRatio * f_inlierRatio * f_inlierRatio));
+    return max((double)RANSAC_MIN_NB_MODELS, min((double)RANSAC_MAX_NB_ITERATIONS, f_nbModels));
+}
+
+
+/**
+ * @brief Check that a transform does not distort too much the bounding
+ * rectangle of the points of the first image.
+ * @param M the transform.
+ */
+bool RigidTransformVerifier::checkTransformedRect(const double M[6]) const
+{
+    // As cv::transform, the points are transformed in single precision.
+    float m[6];
+    for (unsigned l = 0; l < 6; ++l)
+        m[l] = M[l];
+
+    Point2f proj[4];
+    for (unsigned l = 0; l < 4; ++l)
+        proj[l] = Point2f(m[0] * rectPoints[l].x + m[1] * rectPoints[l].y + m[2],
+                          m[3] * rectPoints[l].x + m[4] * rectPoints[l].y + m[5]);
+
+    for (unsigned l = 0; l < 4; ++l)
+    {
+        Point2f v1 = proj[(l + 2) % 4] - proj[(l + 1) % 4];
+        Point2f v2 = proj[l] - proj[(l + 1) % 4];
+
+        float angle = atan2(v1.x * v2.y - v1.y * v2.x, v1.x * v2.x + v1.y * v2.y);
+        if (angle < 20 * M_PI / 180 || angle > 135 * M_PI / 180 || norm(v1) < 100)
+            return false;
+    }
+
+    return true;
+}
+
+
+#ifdef __SSE2__
+/**
+ * @brief Count the inliers of a transform 8 points at a time.
+ */
+__attribute__((target("avx2")))
+static unsigned countInliersAVX2(const float *ax, const float *ay,
+                                 const float *bx, const float *by,
+                                 const float m[6], unsigned i_nbPaddedPoints)
+{
+    const __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]);
+    const __m256 m3 = _mm256_set1_ps(m[3]), m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]);
+    const __m256 maxError = _mm256_set1_ps(RANSAC_MAX_SQUARED_ERROR);
+
+    unsigned i_nbInliers = 0;
+    for (unsigned i = 0; i < i_nbPaddedPoints; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(ax + i), y = _mm256_loadu_ps(ay + i);
+        const __m256 dx = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, x),
+                                                                    _mm256_mul_ps(m1, y)), m2),
+                                        _mm256_loadu_ps(bx + i));
+        const __m256 dy = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m3, x),
+                                                                    _mm256_mul_ps(m4, y)), m5),
+                                        _mm256_loadu_ps(by + i));
+        const __m256 error = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        i_nbInliers += __builtin_popcount(
+            _mm256_movemask_ps(_mm256_cmp_ps(error, maxError, _CMP_LT_OQ)));
+    }
+
+    return i_nbInliers;
+}
+#endif
+
+
+/**
+ * @brief Count the correspondences whose first point is projected by a
+ * transform close to the second one.
+ * @param M the transform.
+ * @param i_nbPoints the number of correspondences.
+ */
+unsigned RigidTransformVerifier::countInliers(const double M[6], unsigned i_nbPoints) const
+{
+    float m[6];
+    for (unsigned l = 0; l < 6; ++l)
+        m[l] = M[l];
+
+    unsigned i_nbInliers = 0;
+#ifdef __SSE2__
+    // The arrays are padded to a multiple of 8 points.
+    static const bool b_hasAVX2 = __builtin_cpu_supports("avx2");
+    if (b_hasAVX2)
+        return countInliersAVX2(ax.data(), ay.data(), bx.data(), by.data(), m,
+                                (i_nbPoints + 7) & ~7);
+
+    const unsigned i_nbPaddedPoints = (i_nbPoints + 3) & ~3;
+
+    const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]);
+    const __m128 m3 = _mm_set1_ps(m[3]), m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]);
+    const __m128 maxError = _mm_set1_ps(RANSAC_MAX_SQUARED_ERROR);
+    for (unsigned i = 0; i < i_nbPaddedPoints; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(&ax[i]), y = _mm_loadu_ps(&ay[i]);
+        const __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)), m2),
+                                     _mm_loadu_ps(&bx[i]));
+        const __m128 dy = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m3, x), _mm_mul_ps(m4, y)), m5),
+                                     _mm_loadu_ps(&by[i]));
+        const __m128 error = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        i_nbInliers += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(error, maxError)));
+    }
+#else
+    for (unsigned i = 0; i < i_nbPoints; ++i)
+    {
+        const float dx = m[0] * ax[i] + m[1] * ay[i] + m[2] - bx[i];
+        const float dy = m[3] * ax[i] + m[4] * ay[i] + m[5] - by[i];
+        i_nbInliers += dx * dx + dy * dy < RANSAC_MAX_SQUARED_ERROR;
+    }
+#endif
+
+    return i_nbInliers;
+}
+
+
+/**
+ * @brief Fit an affine transform on the inliers of another one with the
+ * least squares.
+ * @param M the transform that gives the inliers.
+ * @param i_nbPoints the number of correspondences.
+ * @param f_maxSquaredError the squared distance under which a point is an inlier.
+ * @param fittedM the fitted transform.
+ * @return false if the inliers do not define a transform.
+ */
+bool RigidTransformVerifier::fitInliers(const double M[6], unsigned i_nbPoints,
+                                        float f_maxSquaredError, double fittedM[6])
+{
+    float m[6];
+    for (unsigned l = 0; l < 6; ++l)
+        m[l] = M[l];
+
+    // The normal equations of the two rows of the transform share their matrix.
+    double A[3][3] = {{0}}, rx[3] = {0}, ry[3] = {0};
+    for (unsigned i = 0; i < i_nbPoints; ++i)
+    {
+        const float dx = m[0] * ax[i] + m[1] * ay[i] + m[2] - bx[i];
+        const float dy = m[3] * ax[i] + m[4] * ay[i] + m[5] - by[i];
+        if (!(dx * dx + dy * dy < f_maxSquaredError))
+            continue;
+
+        A[0][0] += ax[i] * ax[i];
+        A[0][1] += ax[i] * ay[i];
+        A[0][2] += ax[i];
+        A[1][1] += ay[i] * ay[i];
+        A[1][2] += ay[i];
+        A[2][2] += 1;
+
+        rx[0] += ax[i] * bx[i];
+        rx[1] += ay[i] * bx[i];
+        rx[2] += bx[i];
+        ry[0] += ax[i] * by[i];
+        ry[1] += ay[i] * by[i];
+        ry[2] += by[i];
+    }
+    A[1][0] = A[0][1];
+    A[2][0] = A[0][2];
+    A[2][1] = A[1][2];
+
+    return solve3x3(A, rx, fittedM) && solve3x3(A, ry, fittedM + 3);
+}
@@ -0,0 +1,270 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <algorithm>
+#include <functional>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <scoreaccumulator.h>
+
+
+/**
+ * @brief Make the accumulator able to receive the scores of i_nbSlots slots.
+ * The accumulator must be empty.
+ */
+void ScoreAccumulator::resize(u_int32_t i_nbSlots)
+{
+    const u_int32_t i_nbBlocks = (i_nbSlots + SCORE_BLOCK_SIZE - 1) >> SCORE_BLOCK_SHIFT;
+    if (i_nbBlocks <= touchedMasks.size())
+        return;
+
+    scores.resize((size_t)i_nbBlocks << SCORE_BLOCK_SHIFT, 0);
+    touchedMasks.resize(i_nbBlocks, 0);
+    touchedBlocks.reserve(i_nbBlocks);
+}
+
+
+/**
+ * @brief Add the scores of another accumulator of the same size to this one.
+ * The other accumulator is reset.
+ * @param acc the other accumulator.
+ */
+void ScoreAccumulator::reduce(ScoreAccumulator &acc)
+{
+    for (unsigned i = 0; i < acc.touchedBlocks.size(); ++i)
+    {
+        const u_int32_t i_block = acc.touchedBlocks[i];
+        if (touchedMasks[i_block] == 0)
+            touchedBlocks.push_back(i_block);
+        touchedMasks[i_block] |= acc.touchedMasks[i_block];
+        acc.touchedMasks[i_block] = 0;
+
+        float *p_dst = &scores[(size_t)i_block << SCORE_BLOCK_SHIFT];
+        float *p_src = &acc.scores[(size_t)i_block << SCORE_BLOCK_SHIFT];
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        for (unsigned j = 0; j < SCORE_BLOCK_SIZE; j += 4)
+        {
+            _mm_storeu_ps(p_dst + j, _mm_add_ps(_mm_loadu_ps(p_dst + j),
+                                                _mm_loadu_ps(p_src + j)));
+            _mm_storeu_ps(p_src + j, zero);
+        }
+#else
+        for (unsigned j = 0; j < SCORE_BLOCK_SIZE; ++j)
+        {
+            p_dst[j] += p_src[j];
+            p_src[j] = 0;
+        }
+#endif
+    }
+    acc.touchedBlocks.clear();
+}
+
+
+/**
+ * @brief Compare two (score, slot) pairs by decreasing score.
+ */
+static bool compareScores(const pair<float, u_int32_t> &a, const pair<float, u_int32_t> &b)
+{
+    return a.first > b.first;
+}
+
+
+/**
+ * @brief Select the touched slots with the k highest scores.
+ * The candidates are buffered and the buffer is cut to its k best slots
+ * each time it holds 2k slots so the selection stays linear whatever the
+ * order of the scores. The slots that are not better than the last k-th
+ * score are not buffered and the blocks without any of them are skipped
+ * as a whole.
+ * @param k the number of slots to select.
+ * @param results a vector to return the slots sorted by decreasing score.
+ * @return the number of touched slots.
+ */
+unsigned ScoreAccumulator::getFirstResults(unsigned k, vector<SearchResult> &results) const
+{
+    results.clear();
+
+    vector<pair<float, u_int32_t> > candidates;
+    candidates.reserve(2 * k);
+    bool b_filter = false;
+    float f_minScore = 0;
+
+    unsigned i_nbTouched = 0;
+    for (unsigned i = 0; i < touchedBlocks.size(); ++i)
+    {
+        const u_int32_t i_block = touchedBlocks[i];
+        u_int64_t i_mask = touchedMasks[i_block];
+        i_nbTouched += __builtin_popcountll(i_mask);
+        const float *p_scores = &scores[(size_t)i_block << SCORE_BLOCK_SHIFT];
+
+#ifdef __SSE2__
+        if (b_filter)
+        {
+            const __m128 minScore = _mm_set1_ps(f_minScore);
+            __m128 above = _mm_setzero_ps();
+            for (unsigned j = 0; j < SCORE_BLOCK_SIZE; j += 4)
+                above = _mm_or_ps(above, _mm_cmpgt_ps(_mm_loadu_ps(p_scores + j), minScore));
+            if (_mm_movemask_ps(above) == 0)
+                continue;
+        }
+#endif
+
+        while (i_mask)
+        {
+            const unsigned i_bit = __builtin_ctzll(i_mask);
+            i_mask &= i_mask - 1;
+            if (k == 0 || (b_filter && p_scores[i_bit] <= f_minScore))
+                continue;
+
+            candidates.push_back(make_pair(p_scores[i_bit], (i_block << SCORE_BLOCK_SHIFT) + i_bit));
+            if (candidates.size() >= 2 * k)
+            {
+                nth_element(candidates.begin(), candidates.begin() + (k - 1),
+                            candidates.end(), compareScores);
+                f_minScore = candidates[k - 1].first;
+                candidates.resize(k);
+                b_filter = true;
+            }
+        }
+    }
+
+    if (candidates.size() > k)
+    {
+        nth_element(candidates.begin(), candidates.begin() + k,
+                    candidates.end(), compareScores);
+        candidates.resize(k);
+    }
+    sort(candidates.begin(), candidates.end(), compareScores);
+
+    results.reserve(candidates.size());
+    for (unsigned i = 0; i < candidates.size(); ++i)
+        results.push_back(SearchResult(candidates[i].first, candidates[i].second, Rect()));
+
+    return i_nbTouched;
+}
+
+
+/**
+ * @brief Count the slots whose score is higher than a positive minimum.
+ * The untouched slots have a null score so the blocks are compared as a whole.
+ * @param f_minScore the minimum score.
+ * @param i_maxCount the count at which the counting can stop.
+ * @return the number of slots, at most i_maxCount.
+ */
+unsigned ScoreAccumulator::countScoresAbove(float f_minScore, unsigned i_maxCount) const
+{
+    unsigned i_count = 0;
+#ifdef __SSE2__
+    const __m128 minScore = _mm_set1_ps(f_minScore);
+#endif
+    for (unsigned i = 0; i < touchedBlocks.size() && i_count < i_maxCount; ++i)
+    {
+        const float *p_scores = &scores[(size_t)touchedBlocks[i] << SCORE_BLOCK_SHIFT];
+#ifdef __SSE2__
+        for (unsigned j = 0; j < SCORE_BLOCK_SIZE; j += 4)
+            i_count += __builtin_popcount(
+                _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(p_scores + j), minScore)));
+#else
+        for (unsigned j = 0; j < SCORE_BLOCK_SIZE; ++j)
+            i_count += p_scores[j] > f_minScore;
+#endif
+    }
+
+    return min(i_count, i_maxCount);
+}
+
+
+/**
+ * @brief Return the k-th largest score of the touched slots.
+ * @param k the rank of the score, starting from 1.
+ * @return the score, 0 if less than k slots are touched.
+ */
+float ScoreAccumulator::getKthScore(unsigned k) const
+{
+    vector<float> touchedScores;
+    for (unsigned i = 0; i < touchedBlocks.size(); ++i)
+    {
+        const u_int32_t i_block = touchedBlocks[i];
+        u_int64_t i_mask = touchedMasks[i_block];
+        while (i_mask)
+        {
+            touchedScores.push_back(scores[(i_block << SCORE_BLOCK_SHIFT)
+                                           + __builtin_ctzll(i_mask)]);
+            i_mask &= i_mask - 1;
+        }
+    }
+
+    if (k == 0 || touchedScores.size() < k)
+        return 0;
+
+    nth_element(touchedScores.begin(), touchedScores.begin() + (k - 1),
+                touchedScores.end(), greater<float>());
+    return touchedScores[k - 1];
+}
+
+
+/**
+ * @brief Forget the touched slots whose score is lower than a minimum.
+ * @param f_minScore the minimum score.
+ */
+void ScoreAccumulator::prune(float f_minScore)
+{
+    vector<u_int32_t>::iterator blockIt = touchedBlocks.begin();
+    for (unsigned i = 0; i < touchedBlocks.size(); ++i)
+    {
+        const u_int32_t i_block = touchedBlocks[i];
+        u_int64_t i_mask = touchedMasks[i_block];
+        while (i_mask)
+        {
+            const unsigned i_bit = __builtin_ctzll(i_mask);
+            const u_int32_t i_slot = (i_block << SCORE_BLOCK_SHIFT) + i_bit;
+            if (scores[i_slot] < f_minScore)
+            {
+                scores[i_slot] = 0;
+                touchedMasks[i_block] &= ~((u_int64_t)1 << i_bit);
+            }
+            i_mask &= i_mask - 1;
+        }
+        if (touchedMasks[i_block] != 0)
+            *blockIt++ = i_block;
+    }
+    touchedBlocks.erase(blockIt, touchedBlocks.end());
+}
+
+
+/**
+ * @brief Set the scores of all the touched slots back to zero.
+ */
+void ScoreAccumulator::reset()
+{
+    for (unsigned i = 0; i < touchedBlocks.size(); ++i)
+    {
+        const u_int32_t i_block = touchedBlocks[i];
+        touchedMasks[i_block] = 0;
+        fill(scores.begin() + ((size_t)i_block << SCORE_BLOCK_SHIFT),
+             scores.begin() + ((size_t)(i_block + 1) << SCORE_BLOCK_SHIFT), 0.f);
+    }
+    touchedBlocks.clear();
+}
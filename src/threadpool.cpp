@@ -0,0 +1,190 @@
+/*****************************************************************************
+ * Copyright (C) 2014 Visualink
+ *
+ * Authors: Adrien Maglo <adrien@visualink.io>
+ *
+ * This file is part of Pastec.
+ *
+ * Pastec is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pastec is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Pastec.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <algorithm>
+#include <unistd.h>
+
+#include <threadpool.h>
+
+
+TaskGroup::TaskGroup()
+    : i_nbPendingTasks(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&doneCond, NULL);
+}
+
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+    pthread_cond_destroy(&doneCond);
+    pthread_mutex_destroy(&mutex);
+}
+
+
+/**
+ * @brief Wait for the end of all the tasks submitted with the group.
+ */
+void TaskGroup::wait()
+{
+    pthread_mutex_lock(&mutex);
+    while (i_nbPendingTasks > 0)
+        pthread_cond_wait(&doneCond, &mutex);
+    pthread_mutex_unlock(&mutex);
+}
+
+
+void TaskGroup::addTask()
+{
+    pthread_mutex_lock(&mutex);
+    i_nbPendingTasks++;
+    pthread_mutex_unlock(&mutex);
+}
+
+
+void TaskGroup::endTask()
+{
+    pthread_mutex_lock(&mutex);
+    if (--i_nbPendingTasks == 0)
+        pthread_cond_broadcast(&doneCond);
+    pthread_mutex_unlock(&mutex);
+}
+
+
+/**
+ * @brief The PoolWorkerThread class
+ * Runs the tasks of a pool until the pool is destroyed.
+ */
+class PoolWorkerThread : public Thread
+{
+public:
+    PoolWorkerThread(ThreadPool *pool)
+        : pool(pool) { }
+
+private:
+    void *run()
+    {
+        ThreadPool::QueuedTask queuedTask;
+        while (pool->getNextTask(queuedTask))
+        {
+            queuedTask.task->run();
+            queuedTask.group->endTask();
+        }
+        return NULL;
+    }
+
+    ThreadPool *pool;
+};
+
+
+/**
+ * @brief Create a pool and start its threads.
+ * @param i_nbThreads the number of threads, 0 for one thread per CPU.
+ */
+ThreadPool::ThreadPool(unsigned i_nbThreads)
+    : b_stop(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&taskCond, NULL);
+
+    if (i_nbThreads == 0)
+        i_nbThreads = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+    for (unsigned i = 0; i < i_nbThreads; ++i)
+    {
+        threads.push_back(new PoolWorkerThread(this));
+        threads.back()->start();
+    }
+}
+
+
+/**
+ * @brief Stop the threads once all the submitted tasks are done.
+ */
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&mutex);
+    b_stop = true;
+    pthread_cond_broadcast(&taskCond);
+    pthread_mutex_unlock(&mutex);
+
+    for (unsigned i = 0; i < threads.size(); ++i)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    pthread_cond_destroy(&taskCond);
+    pthread_mutex_destroy(&mutex);
+}
+
+
+/**
+ * @brief Queue a task to be run by a thread of the pool.
+ * @param task the task. It must not be freed before the end of the group.
+ * @param group the group of the task.
+ */
+void ThreadPool::submit(PoolTask *task, TaskGroup &group)
+{
+    group.addTask();
+
+    QueuedTask queuedTask;
+    queuedTask.task = task;
+    queuedTask.group = &group;
+
+    pthread_mutex_lock(&mutex);
+    tasks.push_back(queuedTask);
+    pthread_cond_signal(&taskCond);
+    pthread_mutex_unlock(&mutex);
+}
+
+
+unsigned ThreadPool::getNbThreads() const
+{
+    return threads.size();
+}
+
+
+/**
+ * @brief Wait for the next task to run.
+ * @param queuedTask the task and its group.
+ * @return false if the pool is stopped and there is no task left.
+ */
+bool ThreadPool::getNextTask(QueuedTask &queuedTask)
+{
+    pthread_mutex_lock(&mutex);
+    while (tasks.empty() && !b_stop)
+        pthread_cond_wait(&taskCond, &mutex);
+
+    if (tasks.empty())
+    {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+
+    queuedTask = tasks.front();
+    tasks.pop_front();
+    pthread_mutex_unlock(&mutex);
+
+    return true;
+}